@@ -572,6 +572,7 @@ void AnsiParser::Parse(const void *data, int size, bool utf8)
 			break;
 		case State::Action::Final:
 			sequence.opcode = (byte) c;
+			Hook();
 			break;
 		case State::Action::Control:
 			WhenCtl((byte) c);
@@ -852,7 +853,30 @@ void AnsiParser::CollectPayload(const byte *start, int c)
 {
 	LTIMING("VtInStream::CollectPayload()");
 	
+	int n = sequence.payload.GetLength();
 	sCollectInto(sequence.payload, start, ptr, end, PayloadPolicy{});
+	UpdatePayloadHash(n);
+	if(hooked) { // Pass the data to the client, instead of accumulating it.
+		WhenDcsPut(sequence, ~sequence.payload + n, sequence.payload.GetLength() - n);
+		sequence.payload.Trim(n);
+	}
+}
+
+force_inline
+void AnsiParser::Hook()
+{
+	// DCS final byte: The client can choose to process the payload as it arrives.
+	
+	if(!WhenDcsHook)
+		return;
+	sequence.type = Sequence::Type::DCS;
+	if(collected.GetCount())
+		sequence.parameters = pick(Split(collected, ';', false));
+	else
+		sequence.parameters.Add();
+	hooked = WhenDcsHook(sequence);
+	if(!hooked) // Dispatch will parametrize the sequence.
+		sequence.parameters.Clear();
 }
 
 force_inline
@@ -860,7 +884,21 @@ void AnsiParser::CollectString(const byte *start, int c)
 {
 	LTIMING("VtInStream::CollectString()");
 	
+	int n = sequence.payload.GetLength();
 	sCollectInto(sequence.payload, start, ptr, end, StringPolicy{ utf8mode });
+	UpdatePayloadHash(n);
+}
+
+force_inline
+void AnsiParser::UpdatePayloadHash(int from)
+{
+	// The hash is updated incrementally, as the payload arrives, so that large
+	// payloads (e.g. inline images) need not be rehashed by their consumers.
+	
+	if(hashpayload && sequence.payload.GetLength() > from) {
+		hasher.Put(~sequence.payload + from, sequence.payload.GetLength() - from);
+		hashed = true;
+	}
 }
 
 force_inline
@@ -869,8 +907,11 @@ void AnsiParser::Dispatch(Sequence::Type type, const Event<const AnsiParser::Seq
 	LTIMING("VtInStream::Dispatch()");
 
 	switch(type) {
-	case Sequence::Type::CSI:
 	case Sequence::Type::DCS:
+		if(hooked) // Already parametrized.
+			break;
+		[[fallthrough]];
+	case Sequence::Type::CSI:
 		if(collected.GetCount())
 			sequence.parameters = pick(Split(collected, ';', false));
 		else // We can have empty parameter list, e.g. \033[m
@@ -886,6 +927,8 @@ void AnsiParser::Dispatch(Sequence::Type type, const Event<const AnsiParser::Seq
 	default:
 		break;
 	}
+	if(hashed)
+		sequence.payloadhash = hasher.Finish();
 	sequence.type = type;
 	fn(sequence);
 	waschr = false;
@@ -930,6 +973,12 @@ void AnsiParser::Reset0(const Vector<AnsiParser::State>* st)
 	state = st;
 	sequence.Clear();
 	collected.Clear();
+	hooked = false;
+	if(hashed) {
+		hasher.Finish(); // Flushes the pending bytes.
+		hasher.Reset();
+		hashed = false;
+	}
 }
 
 AnsiParser::AnsiParser()
@@ -937,6 +986,9 @@ AnsiParser::AnsiParser()
 , begin(nullptr)
 , end(nullptr)
 , parametrize(false)
+, hashpayload(false)
+, hashed(false)
+, hooked(false)
 {
 	Reset();
 }
@@ -966,6 +1018,7 @@ void AnsiParser::Sequence::Clear()
 	Zero(intermediate);
 	parameters.Clear();
 	payload.Clear();
+	payloadhash = 0;
 }
 
 String AnsiParser::Sequence::ToString() const
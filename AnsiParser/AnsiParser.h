@@ -23,6 +23,7 @@ public:
         byte            intermediate[4];
         Vector<String>  parameters;
         String          payload;
+        dword           payloadhash;                            // Content hash of the payload, if enabled.
         int             GetInt(int n, int d = 1) const;
         String          GetStr(int n) const;
         String          ToString() const;
@@ -92,6 +93,8 @@ public:
 
     AnsiParser& ParametrizePayload(bool b = true)               { parametrize = b; return *this; }
     AnsiParser& DontParametrizePayload()                        { return ParametrizePayload(false); }
+    AnsiParser& HashPayload(bool b = true)                      { hashpayload = b; return *this; }
+    AnsiParser& DontHashPayload()                               { return HashPayload(false); }
 
     void        Parse(const void *data, int size, bool utf8);
     void        Parse(const String& data, bool utf8)            { Parse(~data, data.GetLength(), utf8); }
@@ -108,6 +111,8 @@ public:
     Event<const AnsiParser::Sequence&>  WhenEsc;
     Event<const AnsiParser::Sequence&>  WhenCsi;
     Event<const AnsiParser::Sequence&>  WhenDcs;
+    Gate<const AnsiParser::Sequence&>   WhenDcsHook;    // Return true to receive the DCS payload in chunks (via WhenDcsPut).
+    Event<const AnsiParser::Sequence&, const char*, int> WhenDcsPut;
     Event<const AnsiParser::Sequence&>  WhenOsc;
     Event<const AnsiParser::Sequence&>  WhenApc;
     Event<const AnsiParser::Sequence&>  WhenSos;
@@ -127,6 +132,8 @@ private:
     void            CollectParameter(const byte *start, int c);
     void            CollectPayload(const byte *start, int c);
     void            CollectString(const byte *start, int c);
+    void            UpdatePayloadHash(int from);
+    void            Hook();
 
 private:
     byte *ptr, *begin, *end;
@@ -134,7 +141,11 @@ private:
     bool        waschr:1;
     bool        utf8mode:1;
     bool        parametrize:1;
+    bool        hashpayload:1;
+    bool        hashed:1;
+    bool        hooked:1;
     String      collected, buffer;
+    xxHashStream hasher;
     const Vector<AnsiParser::State>*  state;
 };
 
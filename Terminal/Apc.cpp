@@ -21,17 +21,19 @@ bool TerminalCtrl::ParseKittyGraphics(const AnsiParser::Sequence& seq)
 		return false;
 
 	String params, enc;
-	if(!SplitTo(seq.payload.Mid(1), ';', false, params, enc) || IsNull(enc))
-		return false;
+	if(!SplitTo(seq.payload.Mid(1), ';', false, params, enc))
+		params = seq.payload.Mid(1); // Placement and deletion commands have no payload.
 
-	bool more = false;
-	bool query = false;
+	bool more  = false;
+	int  quiet = 0;
+	int  target = 'a';
 	
 	CParser p(params);
 	p.SkipSpaces();
 	
-	auto SendAck = [this](const char *err) {
-		PutAPC(Format("Gi=%ld;%s", chunkedimage.id, err));
+	auto SendAck = [this, &quiet](const char *err) {
+		if(quiet < (strcmp(err, "OK") == 0 ? 1 : 2))
+			PutAPC(Format("Gi=%ld;%s", chunkedimage.id, err));
 	};
 	
 	try {
@@ -61,8 +63,14 @@ bool TerminalCtrl::ParseKittyGraphics(const AnsiParser::Sequence& seq)
 					break;
 				}
 			}
-			if(p.Char3('a', '=', 'q')) {
-				query = true;
+			if(p.Char2('a', '=')) {
+				chunkedaction = p.GetChar();
+			}
+			if(p.Char2('d', '=')) {
+				target = p.GetChar();
+			}
+			if(p.Char2('q', '=')) {
+				quiet = p.ReadInt();
 			}
 			if(p.Char3('o', '=', 'z')) {
 				chunkedimage.Compressed();
@@ -74,21 +82,62 @@ bool TerminalCtrl::ParseKittyGraphics(const AnsiParser::Sequence& seq)
 			else
 				p.Skip();
 		}
-		if(query) {
+
+		switch(chunkedaction) {
+		case 'q':
 			SendAck("OK");
-			return true;
-		}
+			break;
+		case 'p':
+			SendAck(PlaceKittyImage(chunkedimage.id) ? "OK" : "ENOENT:image not found");
+			break;
+		case 'd':
+			DeleteKittyImages(target, chunkedimage.id);
+			break;
+		case 't':
+		case 'T': {
+			if(IsNull(enc))
+				p.ThrowError();
 
-		chunkedimage.data << enc; // Accumulate successive chunks
+			if(!chunkeddecoder.started)
+				chunkeddecoder.Start(chunkedimage, !WhenImage);
+	
+			chunkeddecoder.Put(enc, !more); // Decode successive chunks as they arrive.
+			chunkedhash.Put(enc);
+	
+			if(chunkeddecoder.IsError())
+				p.ThrowError();
+	
+			if(more)
+				return true;
+		
+			chunkedimage.hash = chunkedhash.Finish();
+			if(!WhenImage) // WhenImage receives the data as transmitted, still compressed.
+				chunkedimage.Compressed(false);
+	
+			Image img;
+			if(chunkeddecoder.IsRaw()) {
+				img = chunkeddecoder.GetImage();
+				if(IsNull(img))
+					p.ThrowError();
+			}
+			else
+				chunkedimage.data = pick(chunkeddecoder.data);
 
-		if(chunkedimage.data.GetLength() >= 256 * 1024 * 1024)
+			if(chunkedimage.id && !WhenImage) {
+				StoreKittyImage(chunkedimage, img);
+				if(chunkedaction == 't')
+					SendAck("OK");
+			}
+			else
+			if(chunkedaction == 't')
+				SendAck(WhenImage ? "ENOTSUP:images are handled by the client" : "EINVAL:no image id");
+			if(chunkedaction == 'T')
+				AddKittyPlacement(chunkedimage.id, RenderImage(chunkedimage, true, img));
+			break;
+		}
+		default:
 			p.ThrowError();
-
-		if(more)
-			return true;
-	
-		chunkedimage.Encoded();
-		RenderImage(chunkedimage);
+		}
 	}
 	catch(CParser::Error)
 	{
@@ -102,8 +151,192 @@ bool TerminalCtrl::ParseKittyGraphics(const AnsiParser::Sequence& seq)
 	}
 	
 	chunkedimage.Clear();
+	chunkeddecoder.Clear();
+	chunkedhash.Finish();
+	chunkedhash.Reset();
+	chunkedaction = 'T';
 	return true;
 
 }
 
+void TerminalCtrl::StoreKittyImage(const ImageString& imgs, const Image& img)
+{
+	// Transmitted images with an id are kept, so that they can be placed many times without
+	// being retransmitted or decoded again. The least recently used ones are dropped when
+	// the store exceeds its budget.
+
+	KittyImage& m = kittystore.GetAdd(imgs.id);
+	kittystorebytes -= m.GetSize();
+	m.imgs  = imgs;
+	m.image = img;
+	m.tick  = ++kittystoretick;
+	kittystorebytes += m.GetSize();
+
+	while(kittystorebytes > kittystorebudget && kittystore.GetCount() > 1) {
+		int q = 0;
+		for(int i = 1; i < kittystore.GetCount(); i++)
+			if(kittystore[i].tick < kittystore[q].tick)
+				q = i;
+		kittystorebytes -= kittystore[q].GetSize();
+		kittystore.Remove(q);
+	}
+}
+
+bool TerminalCtrl::PlaceKittyImage(int64 id)
+{
+	int i = kittystore.Find(id);
+	if(i < 0)
+		return false;
+
+	KittyImage& m = kittystore[i];
+	m.tick = ++kittystoretick;
+	AddKittyPlacement(id, RenderImage(m.imgs, true, m.image)); // Decoded data is taken from the image cache, if available.
+	return true;
+}
+
+void TerminalCtrl::AddKittyPlacement(int64 id, dword imageid)
+{
+	// Placed Kitty images are regular image cells. Their image ids are mapped to the Kitty
+	// image ids, so that the deletion commands can find them on the page.
+
+	if(imageid)
+		kittyplacements.GetAdd(imageid) = id;
+}
+
+void TerminalCtrl::DeleteKittyImages(int target, int64 id)
+{
+	// The placements are erased from the page (i.e. their cells are blanked), and the
+	// uppercase targets also free the image data.
+
+	bool all = ToUpper(target) == 'A';
+	if(all || ToUpper(target) == 'I') {
+		bool erased = page->EraseImages([&](dword imageid) {
+			int i = kittyplacements.Find(imageid);
+			return i >= 0 && (all || (id && kittyplacements[i] == id));
+		});
+		if(all)
+			kittyplacements.Clear();
+		if(erased)
+			RefreshDisplay();
+	}
+
+	switch(target) {
+	case 'A':
+		kittystore.Clear();
+		kittystorebytes = 0;
+		break;
+	case 'I':
+		if(int i = kittystore.Find(id); i >= 0) {
+			kittystorebytes -= kittystore[i].GetSize();
+			kittystore.Remove(i);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+void TerminalCtrl::ChunkedImageDecoder::Clear()
+{
+	base64.Clear();
+	zlib.Clear();
+	pixels.Clear();
+	data.Clear();
+	partial.Clear();
+	count   = 0;
+	bpp     = 0;
+	started = false;
+	failed  = false;
+}
+
+void TerminalCtrl::ChunkedImageDecoder::Start(const ImageString& imgs, bool decode)
+{
+	// Raw RGB(A) pixels of known size are written directly into the image buffer, so the
+	// memory use is bounded by the final image size. Compressed data is inflated on the fly.
+	// If decode is false, the data is only base64-decoded (e.g. for WhenImage).
+
+	Clear();
+	started = true;
+
+	if(!decode)
+		return;
+
+	if(imgs.IsRaw() && !IsNull(imgs.size) && imgs.size.cx > 0 && imgs.size.cy > 0) {
+		bpp = imgs.IsRGBA() ? 4 : 3;
+		pixels.Create(imgs.size);
+	}
+
+	if(imgs.IsCompressed()) {
+		zlib.Create().Decompress();
+		zlib->WhenOut = [this](const void *p, int n) { Write((const char*) p, n); };
+	}
+}
+
+void TerminalCtrl::ChunkedImageDecoder::Put(const String& enc, bool last)
+{
+	if(failed)
+		return;
+
+	base64.Put(enc);
+	String s = last ? base64.Get() : base64.Pick();
+
+	if(zlib) {
+		zlib->Put(~s, s.GetLength());
+		if(last)
+			zlib->End();
+		failed = failed || zlib->IsError();
+	}
+	else
+		Write(~s, s.GetLength());
+}
+
+void TerminalCtrl::ChunkedImageDecoder::Write(const char *s, int n)
+{
+	if(failed || n <= 0)
+		return;
+
+	if(!IsRaw()) {
+		data.Cat(s, n);
+		failed = data.GetLength() >= 256 * 1024 * 1024;
+		return;
+	}
+
+	int total = pixels.GetLength();
+	RGBA *t = ~pixels;
+
+	auto PutPixel = [&](const byte *q) {
+		RGBA& c = t[count++];
+		c.r = q[0];
+		c.g = q[1];
+		c.b = q[2];
+		c.a = bpp == 4 ? q[3] : 255;
+	};
+
+	const byte *q = (const byte*) s;
+	const byte *e = q + n;
+
+	while(q < e && partial.GetCount()) { // Complete the pixel split by the previous chunk.
+		partial.Cat(*q++);
+		if(partial.GetCount() == bpp) {
+			if(count < total)
+				PutPixel((const byte*) ~partial);
+			partial.Clear();
+		}
+	}
+
+	for(; q + bpp <= e && count < total; q += bpp)
+		PutPixel(q);
+
+	if(count < total && q < e)
+		partial.Cat((const char*) q, int(e - q));
+}
+
+Image TerminalCtrl::ChunkedImageDecoder::GetImage()
+{
+	if(!IsRaw() || count < pixels.GetLength()) // Incomplete data.
+		return Null;
+	pixels.SetHotSpot(Null);
+	return pixels;
+}
+
 }
\ No newline at end of file
@@ -0,0 +1,133 @@
+#include "Base64.h"
+#include "Simd.h"
+
+#define LLOG(x)		 // RLOG("Base64Decoder: " << x)
+#define LTIMING(x)	 // RTIMING(x)
+
+namespace Upp {
+
+static const byte *sGetBase64Table()
+{
+	static byte table[256];
+	ONCELOCK {
+		const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+		memset(table, 0xFF, sizeof(table));
+		for(int i = 0; i < 64; i++)
+			table[(byte) alphabet[i]] = (byte) i;
+	}
+	return table;
+}
+
+void Base64Decoder::Clear()
+{
+	out.Clear();
+	quad  = 0;
+	count = 0;
+}
+
+force_inline
+void Base64Decoder::Append(byte v)
+{
+	quad = (quad << 6) | v;
+	if(++count == 4) {
+		char b[3] = { (char)(quad >> 16), (char)(quad >> 8), (char) quad };
+		out.Cat(b, 3);
+		quad  = 0;
+		count = 0;
+	}
+}
+
+void Base64Decoder::PutScalar(const byte *s, const byte *e)
+{
+	const byte *table = sGetBase64Table();
+	while(s < e)
+		if(byte v = table[*s++]; v < 64)
+			Append(v);
+}
+
+void Base64Decoder::Put(const void *data, int size)
+{
+	LTIMING("Base64Decoder::Put");
+
+	const byte *s = (const byte*) data;
+	const byte *e = s + size;
+
+#ifdef CPU_SIMD
+	// Blocks of 16 valid characters are translated to their 6-bit values at once,
+	// using range comparisons, and then packed into 12 bytes.
+	while(s + 16 <= e) {
+		if(count) { // Realign to a quad boundary.
+			PutScalar(s, s + 1);
+			s++;
+			continue;
+		}
+		i8x16 c(s);
+		i8x16 upper = (c > i8all('A' - 1)) & (c < i8all('Z' + 1));
+		i8x16 lower = (c > i8all('a' - 1)) & (c < i8all('z' + 1));
+		i8x16 digit = (c > i8all('0' - 1)) & (c < i8all('9' + 1));
+		i8x16 plus  = c == i8all('+');
+		i8x16 slash = c == i8all('/');
+		if(int mask = TerminalSimd::MoveMask(upper | lower | digit | plus | slash) & 0xFFFF; mask != 0xFFFF) {
+			// Padding, whitespace or garbage: Decode up to and including the first such character.
+			int n = CountTrailingZeroBits(~mask & 0xFFFF) + 1;
+			PutScalar(s, s + n);
+			s += n;
+			continue;
+		}
+		i8x16 v = c + ((upper & i8all(-65))
+					| (lower & i8all(-71))
+					| (digit & i8all(4))
+					| (plus  & i8all(19))
+					| (slash & i8all(16)));
+		byte q[16];
+		v.Store(q);
+		char b[12];
+		for(int i = 0, j = 0; i < 16; i += 4, j += 3) {
+			dword w = (q[i] << 18) | (q[i + 1] << 12) | (q[i + 2] << 6) | q[i + 3];
+			b[j]     = (char)(w >> 16);
+			b[j + 1] = (char)(w >> 8);
+			b[j + 2] = (char) w;
+		}
+		out.Cat(b, 12);
+		s += 16;
+	}
+#endif
+
+	PutScalar(s, e);
+}
+
+String Base64Decoder::Get()
+{
+	// Flushes the incomplete quad, if any.
+
+	if(count == 2) {
+		out.Cat((char)(quad >> 4));
+	}
+	else
+	if(count == 3) {
+		out.Cat((char)(quad >> 10));
+		out.Cat((char)(quad >> 2));
+	}
+
+	String s(out);
+	Clear();
+	return s;
+}
+
+String Base64Decoder::Pick()
+{
+	// Returns the bytes decoded so far, keeping the incomplete quad for the next chunk.
+
+	String s(out);
+	out.Clear();
+	return s;
+}
+
+String Base64Decoder::Decode(const void *data, int size)
+{
+	Base64Decoder d;
+	d.Reserve(size / 4 * 3 + 3);
+	d.Put(data, size);
+	return d.Get();
+}
+}
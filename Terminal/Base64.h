@@ -0,0 +1,36 @@
+#ifndef _Terminal_Base64_h_
+#define _Terminal_Base64_h_
+
+#include <Core/Core.h>
+
+namespace Upp {
+
+// Base64Decoder: A streaming base64 decoder that can be fed arbitrary chunks.
+// Characters that are not in the base64 alphabet (padding, whitespace) are skipped.
+
+class Base64Decoder {
+public:
+    Base64Decoder()                                 { Clear(); }
+
+    void            Put(const void *data, int size);
+    void            Put(const String& data)         { Put(~data, data.GetLength()); }
+    String          Get();
+    String          Pick();
+    int             GetLength() const               { return out.GetLength(); }
+    void            Reserve(int size)               { out.Reserve(size); }
+    void            Clear();
+
+    static String   Decode(const void *data, int size);
+    static String   Decode(const String& data)      { return Decode(~data, data.GetLength()); }
+
+private:
+    inline void     Append(byte v);
+    void            PutScalar(const byte *s, const byte *e);
+
+private:
+    StringBuffer    out;
+    dword           quad;
+    int             count;
+};
+}
+#endif
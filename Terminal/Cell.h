@@ -22,7 +22,8 @@ struct VTCell : Moveable<VTCell> {
             word protect_dec : 1;
             word protect_iso : 1;
             word semantic    : 2;  // Bits 2-3 (Fits 0 to 3: None, Prompt, Input, Output)
-            word reserved    : 12;
+            word autolink    : 1;  // Hyperlink is detected in plain text.
+            word reserved    : 11;
         } attr;
     };
 
@@ -87,6 +88,7 @@ struct VTCell : Moveable<VTCell> {
     VTCell& Image(bool b = true)                 { style.image = b; return *this; }
     VTCell& Hyperlink(bool b = true)             { style.hyperlink = b; return *this; }
     VTCell& Annotation(bool b= true)             { style.annotation = b; return *this;}
+    VTCell& AutoLink(bool b = true)              { attr.autolink = b; return *this; }
 
     VTCell& Underline(bool b = true)             { style.underline = b; if(!b) style.underlinestyle = UNDERLINE_SINGLE; return *this; }
     VTCell& SetUnderlineStyle(UnderlineStyle st) { style.underlinestyle = st; return Underline(true); }
@@ -121,6 +123,7 @@ struct VTCell : Moveable<VTCell> {
     bool IsImage() const                         { return style.image;           }
     bool IsHyperlink() const                     { return style.hyperlink;       }
     bool IsAnnotation() const                    { return style.annotation;      }
+    bool IsAutoLink() const                      { return attr.autolink;         }
     int  GetUnderlineStyle() const               { return style.underlinestyle;  }
 
     bool IsWideCharTrail() const                 { return chr == 1;              }
@@ -45,10 +45,10 @@ TerminalCtrl& TerminalCtrl::ResetColors()
 	return *this;
 }
 
-void TerminalCtrl::SetInkAndPaperColor(const VTCell& cell, Color& ink, Color& paper)
+void TerminalCtrl::SetInkAndPaperColor(const VTCell& cell, Color& ink, Color& paper, bool dim)
 {
-	ink = GetColorFromIndex(cell, COLOR_INK);
-	paper = GetColorFromIndex(cell, COLOR_PAPER);
+	ink = GetColorFromIndex(cell, COLOR_INK, dim);
+	paper = GetColorFromIndex(cell, COLOR_PAPER, dim);
 
 	bool invert = cell.IsInverted()
 				^ modes[DECSCNM]
@@ -58,48 +58,99 @@ void TerminalCtrl::SetInkAndPaperColor(const VTCell& cell, Color& ink, Color& pa
 		Swap(ink, paper);
 }
 
-Color TerminalCtrl::GetColorFromIndex(const VTCell& cell, int which) const
+Color TerminalCtrl::GetColorFromIndex(const VTCell& cell, int which, bool dim) const
 {
 	Color color = (which == COLOR_INK) ? cell.ink : cell.paper;
-	bool dim = (which == COLOR_INK) && cell.IsFaint();
-	int index = which;
-
-	if(!IsNull(color)) {
-		int c = color.GetSpecial();
-		if(c >= 0) {
-			index = c;
-			if(index > 15 && index < 256) {
-				int v = index - 16;
-				if(index < 232) {
-					// 256-color (6x6x6 cube & grayscale)
-					auto cstep = [](int i) {
-						return i == 0 ? 0 : 55 + i * 40;
-					};
-					color = Color(cstep(v / 36), cstep((v % 36) / 6), cstep(v % 6));
-				}
-				else {
-					// Grayscale is correct: 232 = 8, 255 = 238
-					int gray = (index - 232) * 10 + 8;
-					color = Color(gray, gray, gray);
-				}
-			}
-		}
+	bool faint  = (which == COLOR_INK) && cell.IsFaint();
+	int  index  = IsNull(color) ? (which == COLOR_INK ? PALETTE_INK : PALETTE_PAPER) : color.GetSpecial();
+
+	if(index < 0 || (index > 255 && !IsNull(color))) {
+		// True colors are not cached.
+		if(faint)
+			color = Blend(color, Black(), 77);
+		return dim ? Blend(color, Black(), ((100 - brightness) * 255) / 100) : color;
+	}
+
+	bool bright = lightcolors || (intensify && which == COLOR_INK && cell.IsBold());
+
+	if(palette.IsEmpty()) {
+		color = ResolveColor(index, bright, faint);
+		return dim ? Blend(color, Black(), ((100 - brightness) * 255) / 100) : color;
 	}
 
-	// Only map through colortable if it's the default background/foreground
-	// OR if it's an explicit 0-15 base special color index.
-	if(IsNull(color) || (color.GetSpecial() >= 0 && color.GetSpecial() <= 15)) {
-		if(lightcolors || (intensify && which == COLOR_INK && cell.IsBold())) {
-			if(index < 8)
-				index += 8;
+	return palette[GetPaletteIndex(index, bright, faint, dim)];
+}
+
+Color TerminalCtrl::ResolveColor(int index, bool bright, bool faint) const
+{
+	Color color;
+
+	if(index > 15 && index < 256) {
+		int v = index - 16;
+		if(index < 232) {
+			// 256-color (6x6x6 cube & grayscale)
+			auto cstep = [](int i) {
+				return i == 0 ? 0 : 55 + i * 40;
+			};
+			color = Color(cstep(v / 36), cstep((v % 36) / 6), cstep(v % 6));
 		}
+		else {
+			// Grayscale is correct: 232 = 8, 255 = 238
+			int gray = (index - 232) * 10 + 8;
+			color = Color(gray, gray, gray);
+		}
+	}
+	else {
+		// Only map through colortable if it's the default background/foreground
+		// OR if it's an explicit 0-15 base special color index.
+		if(index == PALETTE_INK)
+			index = COLOR_INK;
+		else
+		if(index == PALETTE_PAPER)
+			index = COLOR_PAPER;
+		else
+		if(bright && index < 8)
+			index += 8;
 		color = colortable[index];
 
 		if(adjustcolors)
 			color = AdjustIfDark(color);
 	}
 
-	return dim ? Blend(color, Black(), 77) : color;
+	return faint ? Blend(color, Black(), 77) : color;
+}
+
+void TerminalCtrl::SyncPalette()
+{
+	// The resolved colors are cached, and rebuilt only when the
+	// color table, color adjustment, or brightness level changes.
+
+	LTIMING("TerminalCtrl::SyncPalette");
+
+	int state = brightness | (adjustcolors << 8) | (IsDarkTheme() << 9);
+	bool changed = palette.IsEmpty() || state != palettestate;
+
+	for(int i = 0; i < MAX_COLOR_COUNT; i++)
+		if(palettekey[i] != colortable[i]) {
+			palettekey[i] = colortable[i];
+			changed = true;
+		}
+
+	if(!changed)
+		return;
+
+	palettestate = state;
+	palettegen++;
+	int dimalpha = ((100 - brightness) * 255) / 100;
+	palette.SetCount(2 * PALETTE_SIZE * 4);
+
+	for(int i = 0; i < PALETTE_SIZE; i++)
+		for(int j = 0; j < 4; j++) {
+			bool bright = j & 2, faint = j & 1;
+			Color c = ResolveColor(i, bright, faint);
+			palette[GetPaletteIndex(i, bright, faint, false)] = c;
+			palette[GetPaletteIndex(i, bright, faint, true)]  = Blend(c, Black(), dimalpha);
+		}
 }
 
 void TerminalCtrl::ReportANSIColor(int opcode, int index, const Color& c)
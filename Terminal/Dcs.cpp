@@ -11,6 +11,21 @@ void TerminalCtrl::ParseDeviceControlStrings(const AnsiParser::Sequence& seq)
 
 	const CbFunction *p = FindFunctionPtr(seq);
 	if(p) p->c(*this, seq);
+	sixelstream.Clear();
+}
+
+bool TerminalCtrl::HookDeviceControlString(const AnsiParser::Sequence& seq)
+{
+	// Sixel images are decoded as their data arrives.
+
+	sixelstream.Clear();
+
+	if(!sixelimages || WhenImage || seq.opcode != 'q' || seq.intermediate[0] || !FindFunctionPtr(seq))
+		return false;
+
+	sixelstream.Create<SixelStream>(modes[XTSPREG] ? nullptr : &sixelpalette)
+		.Background(seq.GetInt(2, 0) != 2);
+	return true;
 }
 
 void TerminalCtrl::SetUserDefinedKeys(const AnsiParser::Sequence& seq)
@@ -252,10 +267,21 @@ void TerminalCtrl::ParseSixelGraphics(const AnsiParser::Sequence& seq)
 
 	ImageString imgs;
 	imgs.FmtSixel().Transparent(seq.GetInt(2, 0) != 2).data = seq.payload;
+	imgs.hash = seq.payloadhash;
 
 	if(!modes[XTSPREG])
 		imgs.palette = &sixelpalette;
 
+	if(sixelstream) { // Decoded incrementally.
+		Image img = sixelstream->Finish();
+		sixelstream.Clear();
+		if(!imgs.hash) // Payload hashing is disabled.
+			imgs.hash = (dword) img.GetSerialId();
+		if(!IsNull(img))
+			RenderImage(imgs, !modes[DECSDM], img);
+		return;
+	}
+
 	RenderImage(imgs, !modes[DECSDM]);
 }
 
@@ -50,10 +50,12 @@ void TerminalCtrl::DisplayAlignmentTest()
 	DECom(false);
 	cellattrs.Normal();
 	
-	for(VTLine& line : *page)
+	for(VTLine& line : *page) {
 		for(VTCell& cell : line) {
 			cell.Reset();
 			cell = 'E';
 		}
+		line.Invalidate();
+	}
 }
 }
\ No newline at end of file
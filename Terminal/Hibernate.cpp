@@ -0,0 +1,168 @@
+#include "Terminal.h"
+
+#define LLOG(x)     // RLOG("TerminalCtrl (#" << this << "]: " << x)
+#define LTIMING(x)	// RTIMING(x)
+
+namespace Upp {
+
+// Hibernation support.
+
+// A terminal that stays hidden for a while packs its pages, history buffer and images into a
+// compressed session snapshot, and releases them. The output it receives meanwhile is queued
+// as is, without parsing. The terminal is expanded, and the queued output is parsed, when it
+// is shown again, when the queue gets too large, or when the output seems to contain a request
+// that expects a reply.
+
+static constexpr int sMaxHibernationQueue = 1024 * 1024;
+
+static bool sHasRequests(const byte *s, const byte *e)
+{
+	// This is only a heuristic, e.g. the requests split between two writes are missed.
+
+	for(; s < e; s++) {
+		if(*s == 0x05) // ENQ
+			return true;
+		if(*s != 0x1B || s + 1 >= e)
+			continue;
+		const byte *q = s + 2;
+		switch(s[1]) {
+		case 'P': // DCS (DECRQSS, XTGETTCAP, etc.)
+		case 'Z': // DECID
+			return true;
+		case ']': // OSC color and clipboard queries.
+			for(; q < e && *q != 0x07 && *q != 0x1B; q++)
+				if(*q == '?')
+					return true;
+			break;
+		case '[':
+			while(q < e && *q >= 0x20 && *q <= 0x3F)
+				q++;
+			if(q < e && ((*q && strchr("cntx", *q))
+			|| (*q == 'p' && q[-1] == '$')      // DECRQM
+			|| (*q == 'q' && s[2] == '>')       // XTVERSION
+			|| (*q == 'u' && s[2] == '?')))     // Kitty keyboard protocol query.
+				return true;
+			break;
+		default:
+			break;
+		}
+	}
+	return false;
+}
+
+TerminalCtrl& TerminalCtrl::Hibernation(int idle)
+{
+	hibernationdelay = max(0, idle);
+	if(hibernationdelay)
+		ScheduleHibernation();
+	else {
+		KillTimeCallback(TIMEID_HIBERNATE);
+		Wake();
+	}
+	return *this;
+}
+
+void TerminalCtrl::ScheduleHibernation()
+{
+	// Restarted on each skipped frame, so the terminal hibernates only when it is also idle.
+
+	if(hibernationdelay > 0 && !hibernating && IsDisplayHidden())
+		KillSetTimeCallback(hibernationdelay, [=] { if(IsDisplayHidden()) Hibernate(); }, TIMEID_HIBERNATE);
+}
+
+bool TerminalCtrl::Hibernate()
+{
+	if(hibernating)
+		return true;
+
+	LTIMING("TerminalCtrl::Hibernate");
+
+	int64 cellbytes = 0;
+	for(const VTPage *p : { &dpage, &apage })
+		for(int i = 0; i < p->GetLineCount(); i++)
+			cellbytes += sizeof(VTLine) + p->FetchLine(i).GetAlloc() * sizeof(VTCell);
+
+	StringStream ss;
+	if(!SaveSession(ss))
+		return false;
+
+	String snapshot = ss.GetResult();
+	hibernated = ZCompress(snapshot);
+	hibernating = true;
+
+	dpage.Release();
+	apage.Release();
+	hypertexts.Clear();
+	hypertextcount = 0;
+	imagestore.Clear();
+	imagestorebytes = 0;
+	scaledimages.Clear();
+	linerasters.Clear();
+	highlightcache.Clear();
+	KillTimeCallback(TIMEID_REFRESH);
+	KillTimeCallback(TIMEID_BLINK);
+
+	hibernationstats.hibernations++;
+	hibernationstats.cellbytes     = cellbytes;
+	hibernationstats.snapshotbytes = snapshot.GetLength();
+	hibernationstats.packedbytes   = hibernated.GetLength();
+
+	LLOG("Hibernate() -> cells: " << cellbytes << " bytes, snapshot: " << snapshot.GetLength()
+		<< " bytes, packed: " << hibernated.GetLength() << " bytes");
+	return true;
+}
+
+void TerminalCtrl::Wake()
+{
+	if(!hibernating)
+		return;
+
+	LTIMING("TerminalCtrl::Wake");
+
+	hibernating = false;
+	StringStream ss(ZDecompress(hibernated));
+	hibernated.Clear();
+	if(!LoadSession(ss))
+		LLOG("Wake() -> Unable to restore the hibernated session.");
+
+	hibernationstats.wakeups++;
+	hibernationstats.queuedbytes += queuedout.GetLength();
+
+	if(String s = pick(queuedout); !s.IsEmpty()) {
+		PreParse();
+		parser.Parse(~s, s.GetLength(), queuedutf8);
+		PostParse();
+		SyncPages();
+	}
+
+	ScheduleRefresh();
+	ScheduleHibernation();
+}
+
+void TerminalCtrl::WakeForAccess() const
+{
+	// The public page readers see the expanded session.
+
+	if(hibernating)
+		const_cast<TerminalCtrl*>(this)->Wake();
+}
+
+bool TerminalCtrl::QueueOutput(const void *data, int size, bool utf8)
+{
+	// Returns false if the output is to be parsed by the caller.
+
+	if(!queuedout.IsEmpty() && queuedutf8 != utf8) {
+		Wake();
+		return false;
+	}
+
+	queuedout.Cat((const char *) data, size);
+	queuedutf8 = utf8;
+
+	if(queuedout.GetLength() >= sMaxHibernationQueue
+	|| sHasRequests((const byte *) data, (const byte *) data + size))
+		Wake();
+	return true;
+}
+
+}
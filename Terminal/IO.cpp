@@ -7,11 +7,13 @@ namespace Upp {
 
 void TerminalCtrl::InitParser(AnsiParser& vts)
 {
-	vts.ParametrizePayload().Reset();
+	vts.ParametrizePayload().HashPayload().Reset();
 	vts.WhenCtl = [this](byte c) { ParseControlChars(c); };
 	vts.WhenEsc = [this](const AnsiParser::Sequence& seq) { ParseEscapeSequences(seq); };
 	vts.WhenCsi = [this](const AnsiParser::Sequence& seq) { ParseCommandSequences(seq); };
 	vts.WhenDcs = [this](const AnsiParser::Sequence& seq) { ParseDeviceControlStrings(seq); };
+	vts.WhenDcsHook = [this](const AnsiParser::Sequence& seq) { return HookDeviceControlString(seq); };
+	vts.WhenDcsPut  = [this](const AnsiParser::Sequence& seq, const char *data, int size) { if(sixelstream) sixelstream->Put(data, size); };
 	vts.WhenOsc = [this](const AnsiParser::Sequence& seq) { ParseOperatingSystemCommands(seq); };
 	vts.WhenApc = [this](const AnsiParser::Sequence& seq) { ParseApplicationProgrammingCommands(seq); };
 	vts.WhenChr = [this](const int* unicode, const byte* ascii, int length) { PutChars(unicode, ascii, length); };
@@ -187,9 +189,13 @@ void TerminalCtrl::Write(const void *data, int size, bool utf8)
 	LTIMING("Write");
 
 	if(size > 0) {
+		framebytes += size;
+		if(hibernating && QueueOutput(data, size, utf8))
+			return;
 		PreParse();
 		parser.Parse(data, size, utf8);
 		PostParse();
+		SyncPages();
 	}
 }
 
@@ -443,11 +449,13 @@ TerminalCtrl& TerminalCtrl::PutEol()
 TerminalCtrl& TerminalCtrl::Echo(const String& s)
 {
 	if(s.GetLength()) {
+		Wake();
 		AnsiParser echoparser;
 		InitParser(echoparser);
 		PreParse();
 		echoparser.Parse(s, IsUtf8Mode());
 		PostParse();
+		SyncPages();
 	}
 	return *this;
 }
@@ -554,6 +562,8 @@ void TerminalCtrl::Jsonize(JsonIO& jio)
 		("ClipboardAccess",     clipaccess)
 		("DelayedRefresh",      delayedrefresh)
 		("LazyResize",          lazyresize)
+		("ScrollBlit",          scrollblit)
+		("ReleaseAlternatePage", releasepage)
 		("SizeHint",            sizehint)
 		("BrightBoldText",      intensify)
 		("BlinkingText",        blinkingtext)
@@ -570,6 +580,7 @@ void TerminalCtrl::Jsonize(JsonIO& jio)
 	if(jio.IsLoading()) {
 		SetCharset(CharsetByName(chrset));
 		SetEmulation(clevel, false);
+		ScrollBlit(scrollblit);
 		Layout();
 	}
 }
@@ -579,4 +590,130 @@ void TerminalCtrl::Xmlize(XmlIO& xio)
 	XmlizeByJsonize(xio, *this);
 }
 
+bool TerminalCtrl::SaveSession(Stream& s)
+{
+	if(hibernating && queuedout.IsEmpty()) { // The packed snapshot is still up to date.
+		s.Put(ZDecompress(hibernated));
+		return !s.IsError();
+	}
+
+	Wake();
+	s.SetStoring();
+	SerializeSession(s);
+	return !s.IsError();
+}
+
+bool TerminalCtrl::LoadSession(Stream& s)
+{
+	// The snapshot is streamed directly into the pages. If it turns out to be
+	// invalid halfway, the terminal is reset. A hibernated session is replaced.
+
+	if(hibernating) {
+		hibernating = false;
+		hibernated.Clear();
+		queuedout.Clear();
+	}
+
+	s.SetLoading();
+	s.LoadThrowing();
+	try {
+		SerializeSession(s);
+	}
+	catch(LoadingError) {
+		LLOG("LoadSession() -> Invalid session snapshot.");
+	}
+
+	bool ok = !s.IsError();
+	if(!ok) {
+		hypertexts.Clear();
+		hypertextcount = 0;
+		imagestore.Clear();
+		imagestorebytes = 0;
+		Reset(true);
+	}
+
+	// The page size may differ from the snapshot's, and the resizes are not reported
+	// while hibernating: Let the client know the actual size.
+	SyncSize(true);
+	SyncSb(true);
+	ClearSelection();
+	Refresh();
+	ScheduleHibernation();
+	return ok;
+}
+
+void TerminalCtrl::SerializeSession(Stream& s)
+{
+	LTIMING("TerminalCtrl::SerializeSession");
+
+	s.Magic(0x53535456); // "VTSS"
+
+	int version = 1;
+	s / version;
+	if(version < 1 || version > 1) {
+		s.LoadError();
+		return;
+	}
+
+	bool  alternate = IsAlternatePage();
+	int64 modebits  = 0;
+	for(int i = 0; i < VTMODECOUNT; i++)
+		if(modes[i])
+			modebits |= (int64) 1 << i;
+
+	s % clevel;
+	s % alternate;
+	s % modebits;
+	s % cellattrs;
+	s % cellattrs_backup;
+	s % gsets;
+	s % gsets_backup;
+	s % caret;
+	s % caretbackup;
+	s % udk;
+
+	// The cells refer to the hypertexts by their position, so the unlinked entries are kept.
+	int count = hypertexts.GetCount();
+	s / count;
+	if(s.IsLoading()) {
+		if(count < 0) {
+			s.LoadError();
+			return;
+		}
+		hypertexts.Clear();
+		hypertextcount = 0;
+	}
+	for(int i = 0; i < count && !s.IsError(); i++) {
+		String uri;
+		bool unlinked = false;
+		if(s.IsStoring()) {
+			uri = hypertexts[i];
+			unlinked = hypertexts.IsUnlinked(i);
+		}
+		s % uri % unlinked;
+		if(s.IsLoading()) {
+			hypertexts.Add(uri);
+			if(unlinked)
+				hypertexts.Unlink(i);
+			else
+				hypertextcount++;
+		}
+	}
+	if(s.IsLoading())
+		hypertextsweep = max(2 * hypertextcount, 1024);
+
+	dpage.SerializeSnapshot(s);
+	apage.SerializeSnapshot(s);
+	SerializeImages(s);
+
+	if(s.IsLoading() && !s.IsError()) {
+		clevel = clamp((int) clevel, (int) LEVEL_0, (int) LEVEL_4);
+		modes.Clear();
+		for(int i = 0; i < VTMODECOUNT; i++)
+			if(modebits & ((int64) 1 << i))
+				modes.Set(i);
+		page = alternate ? &apage : &dpage;
+	}
+}
+
 }
\ No newline at end of file
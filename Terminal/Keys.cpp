@@ -556,6 +556,14 @@ bool TerminalCtrl::NavKey(dword key, int count)
 	if(Match(AK_MOVE_END, key)) {
 		sb.End();
 	}
+	else
+	if(Match(AK_MOVE_PREVPROMPT, key)) {
+		GotoPreviousPrompt();
+	}
+	else
+	if(Match(AK_MOVE_NEXTPROMPT, key)) {
+		GotoNextPrompt();
+	}
 	else
 		return false;
 
@@ -0,0 +1,262 @@
+#include "Terminal.h"
+
+#define LLOG(x)     // RLOG("TerminalCtrl (#" << this << "]: " << x)
+#define LTIMING(x)	// RTIMING(x)
+
+namespace Upp {
+
+// Plain-text link detection.
+
+// Links are detected once per logical line, when the line is first displayed after a change.
+// The detected spans are stored in the cells themselves, as regular (but flagged) hyperlinks,
+// so hovering and clicking cost the same as with the explicit (OSC 8) hyperlinks, and moving
+// around in the history buffer never rescans the text.
+
+// Very long logical lines (e.g. base64 data) are scanned in windows of this many physical lines.
+static constexpr int sMaxLinkSpan = 64;
+
+static bool sIsWordChar(int c)
+{
+	return IsLetter(c) || IsDigit(c) || c == '_';
+}
+
+static bool sIsUrlChar(int c)
+{
+	return c > 32 && c != 127 && !(c < 128 && strchr("<>\"`{}|\\^", c));
+}
+
+static bool sIsPathChar(int c)
+{
+	return IsLetter(c) || IsDigit(c) || (c > 32 && c < 128 && strchr("/._-+~", c));
+}
+
+static int sTrimUrl(const WString& t, int b, int e)
+{
+	// Strip the trailing punctuation, and the closing brackets that don't belong to the url.
+
+	while(e > b) {
+		int c = t[e - 1];
+		if(c > 32 && c < 128 && strchr(".,;:!?'", c)) {
+			e--;
+		}
+		else
+		if(c == ')' || c == ']') {
+			int depth = 0;
+			for(int i = b; i < e; i++)
+				depth += (t[i] == '(' || t[i] == '[') - (t[i] == ')' || t[i] == ']');
+			if(depth >= 0)
+				break;
+			e--;
+		}
+		else
+			break;
+	}
+	return e;
+}
+
+static int sMatchUrl(const WString& t, int i)
+{
+	int n = t.GetLength(), j = i;
+	if(!(t[i] < 128 && IsAlpha(t[i])))
+		return i;
+	while(j < n && t[j] < 128 && (IsAlNum(t[j]) || t[j] == '+' || t[j] == '-' || t[j] == '.'))
+		j++;
+	int k = 0;
+	if(j + 3 <= n && t[j] == ':' && t[j + 1] == '/' && t[j + 2] == '/')
+		k = j + 3;
+	else
+	if(j - i == 6 && j < n && t[j] == ':' && ToLower(t.Mid(i, 6).ToString()) == "mailto")
+		k = j + 1;
+	else
+		return i;
+	int e = k;
+	while(e < n && sIsUrlChar(t[e]))
+		e++;
+	e = sTrimUrl(t, k, e);
+	return e > k ? e : i;
+}
+
+static int sMatchPath(const WString& t, int i)
+{
+	int n = t.GetLength(), j = i, slashes = 0, dots = 0;
+	while(j < n && sIsPathChar(t[j])) {
+		slashes += t[j] == '/';
+		dots += t[j] == '.';
+		j++;
+	}
+	while(j > i && t[j - 1] == '.') // End of a sentence.
+		dots--, j--;
+	if(j == i)
+		return i;
+
+	// file:line[:column]
+	if(j + 1 < n && t[j] == ':' && IsDigit(t[j + 1])) {
+		if(!slashes && !dots)
+			return i;
+		int e = j + 1;
+		while(e < n && IsDigit(t[e]))
+			e++;
+		if(e + 1 < n && t[e] == ':' && IsDigit(t[e + 1]))
+			for(e++; e < n && IsDigit(t[e]); e++)
+				;
+		return e;
+	}
+
+	// Absolute, home-relative or explicitly relative paths.
+	bool rooted = t[i] == '/'
+		|| (t[i] == '~' && i + 1 < n && t[i + 1] == '/')
+		|| (t[i] == '.' && i + 1 < n && (t[i + 1] == '/' || (t[i + 1] == '.' && i + 2 < n && t[i + 2] == '/')));
+	return rooted && slashes >= 2 && (j >= n || !sIsWordChar(t[j])) ? j : i;
+}
+
+static int sMatchHash(const WString& t, int i)
+{
+	int n = t.GetLength(), j = i, letters = 0;
+	for(; j < n; j++) {
+		int c = t[j];
+		if(c >= 'a' && c <= 'f')
+			letters++;
+		else
+		if(c < '0' || c > '9')
+			break;
+	}
+	int len = j - i;
+	if(j < n && sIsWordChar(t[j]))
+		return i;
+	return len >= 7 && len <= 64 && letters > 0 && letters < len ? j : i;
+}
+
+static void sFindLinks(const WString& t, dword flags, Vector<Tuple<int, int>>& spans)
+{
+	for(int i = 0, n = t.GetLength(); i < n;) {
+		if(i > 0 && sIsWordChar(t[i - 1])) { // Links start at word boundaries.
+			i++;
+			continue;
+		}
+		int e = i;
+		if(flags & TerminalCtrl::AUTOLINK_URL)
+			e = sMatchUrl(t, i);
+		if(e == i && (flags & TerminalCtrl::AUTOLINK_PATH))
+			e = sMatchPath(t, i);
+		if(e == i && (flags & TerminalCtrl::AUTOLINK_HASH))
+			e = sMatchHash(t, i);
+		if(e > i) {
+			spans.Add(MakeTuple(i, e));
+			i = e;
+		}
+		else { // Skip the rest of the run, so that it is not rescanned from each of its chars.
+			e = i + 1;
+			while(e < n && sIsPathChar(t[e]))
+				e++;
+			i = e;
+		}
+	}
+}
+
+TerminalCtrl& TerminalCtrl::AutoLinks(dword flags)
+{
+	if(flags != autolinks) {
+		autolinks = flags;
+		ResetLinks(dpage);
+		ResetLinks(apage);
+		RefreshDisplay();
+	}
+	return *this;
+}
+
+void TerminalCtrl::ResetLinks(VTPage& p)
+{
+	// Schedules a rescan of the whole buffer, or drops the detected links if detection is disabled.
+
+	for(int i = 0; i < p.GetLineCount(); i++) {
+		const VTLine& line = p.FetchLine(i);
+		if(!autolinks && line.HasHypertext()) {
+			bool changed = false;
+			for(const VTCell& cell : line)
+				if(cell.IsAutoLink()) {
+					const_cast<VTCell&>(cell).AutoLink(false).Hyperlink(false).data = 0;
+					changed = true;
+				}
+			if(changed)
+				line.Invalidate();
+		}
+		line.LinksScanned(false);
+	}
+}
+
+void TerminalCtrl::DetectLinks(int begin, int end)
+{
+	if(!autolinks || !hyperlinks || begin >= end)
+		return;
+
+	LTIMING("TerminalCtrl::DetectLinks");
+
+	// Only the logical lines that have changed since their last scan are scanned, from their
+	// first changed physical line on. The scan starts earlier if a link can cross into it.
+	begin = page->GetLineSpan(begin, sMaxLinkSpan).a;
+	end   = page->GetLineSpan(end - 1, sMaxLinkSpan).b + 1;
+	page->FetchLogicalLines(begin, end, [&](const LogicalLineView& v) {
+		int i = 0;
+		while(i < v.GetLineCount() && v.GetLine(i).IsLinksScanned())
+			i++;
+		if(i == v.GetLineCount())
+			return false;
+		for(int n = 0; i > 0 && n < sMaxLinkSpan; i--, n++) {
+			const VTLine& prev = v.GetLine(i - 1);
+			if(prev.IsEmpty() || prev.Top().chr <= 32)
+				break;
+		}
+		ScanLinks(i ? LogicalLineView(*page, MakeTuple(v.GetFirst() + i, v.GetLast())) : v);
+		return false;
+	});
+}
+
+void TerminalCtrl::ScanLinks(const LogicalLineView& v)
+{
+	LTIMING("TerminalCtrl::ScanLinks");
+
+	// Flatten the logical line into text, one char per cell.
+	WString text;
+	Vector<int> cols;
+	for(auto q = v.begin(); q != v.end(); ++q) {
+		if(q->IsWideCharTrail())
+			continue;
+		text.Cat(q->chr >= 32 && !q->IsImage() ? (int) q->chr : ' ');
+		cols.Add(q.GetColumn());
+	}
+
+	Vector<Tuple<int, int>> spans;
+	sFindLinks(text, autolinks, spans);
+
+	// The cells are modified in place, as in VTPage::FetchCellsMutable().
+	auto Mutable = [](const VTCell& cell) -> VTCell& { return const_cast<VTCell&>(cell); };
+
+	bool changed = false;
+	for(const VTCell& cell : v)
+		if(cell.IsAutoLink()) {
+			Mutable(cell).AutoLink(false).Hyperlink(false).data = 0;
+			changed = true;
+		}
+
+	for(const auto& span : spans) {
+		int b = cols[span.a], e = cols[span.b - 1] + 1;
+		bool explicitlink = false;
+		for(int j = b; j < e && !explicitlink; j++)
+			explicitlink = v[j].IsHypertext();
+		if(explicitlink)
+			continue;
+		dword id = RenderHypertext(ToUtf8(~text + span.a, span.b - span.a));
+		for(int j = b; j < e; j++)
+			Mutable(v[j]).AutoLink().Hyperlink().data = id;
+		changed = true;
+	}
+
+	for(int i = 0; i < v.GetLineCount(); i++) {
+		const VTLine& line = v.GetLine(i);
+		if(changed)
+			line.Invalidate();
+		line.LinksScanned();
+	}
+}
+
+}
@@ -251,13 +251,14 @@ void TerminalCtrl::XTasbm(int mode, bool b)
 		break;
 	case 1047:
 		AlternateScreenBuffer(b);
-		if(!b) apage.Reset();
+		if(!b) releasepage ? apage.Release() : apage.Reset();
 		break;
 	case 1049:
 		if(b) Backup();
 		AlternateScreenBuffer(b);
 		if(b) apage.Reset();
 		else  Restore();
+		if(!b && releasepage) apage.Release();
 	}
 
 	SwapPage();
@@ -88,6 +88,7 @@ void TerminalCtrl::ParseJexerGraphics(const AnsiParser::Sequence& seq)
 		simg.data    = pick(seq.GetStr(4));
 	}
 
+	simg.hash = seq.payloadhash;
 	cellattrs.Hyperlink(false);
 
 	RenderImage(simg, scroll);
@@ -167,6 +168,7 @@ bool TerminalCtrl::ParseiTerm2Graphics(const AnsiParser::Sequence& seq)
 
 	ImageString simg(pick(enc));
 	simg.FmtRaster().Encoded();
+	simg.hash = seq.payloadhash;
 
 	simg.size.Clear();
 	bool show = false;
@@ -202,7 +204,7 @@ bool TerminalCtrl::ParseiTerm2BackgroundChange(const AnsiParser::Sequence& seq)
 	String path = seq.GetStr(2);
 	int pos = path.FindAfter("SetBackgroundImageFile=");
 	if(pos >= 0)
-		WhenBackgroundChange(Base64Decode(path.Mid(pos)));
+		WhenBackgroundChange(Base64Decoder::Decode(path.Mid(pos)));
 	return pos >= 0;
 }
 
@@ -261,7 +263,7 @@ void TerminalCtrl::ParseClipboardRequests(const AnsiParser::Sequence& seq)
 	else
 	if(IsClipboardWritePermitted()) {
 		if(FindMatch(data, CheckInvalidBase64Chars) < 0) {
-			String in = Base64Decode(data);
+			String in = Base64Decoder::Decode(data);
 			if(!IsNull(in))
 				Copy(DecodeDataString(in));
 		}
@@ -293,6 +295,10 @@ void TerminalCtrl::ParseSemanticInformation(const AnsiParser::Sequence& seq)
 	case 'C': cellattrs.SetAsOutput(); break;
 	default:  cellattrs.ClearSemanticInfo(); break;
 	}
+
+	// Index the command boundaries, so that prompts and outputs can be found without scanning the buffer.
+	if(s[0] >= 'A' && s[0] <= 'D')
+		page->AddSemanticMark(s[0] == 'D' ? VTCell::SEMANTIC_NONE : cellattrs.attr.semantic);
 }
 
 void TerminalCtrl::ParseTerminalCtrlProtocols(const AnsiParser::Sequence& seq)
@@ -311,7 +317,7 @@ void TerminalCtrl::ParseTerminalCtrlAnnotations(const AnsiParser::Sequence& seq)
 	String type = seq.GetStr(3);
 	String anno = seq.GetStr(4);
 
-	anno = Base64Decode(anno);
+	anno = Base64Decoder::Decode(anno);
 	
 	if(IsNull(anno) || anno.GetLength() > MAX_ANNOTATION_LENGTH) {
 		cellattrs.Annotation(false);
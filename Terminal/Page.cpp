@@ -8,6 +8,9 @@ namespace Upp {
 VTLine::VTLine()
 : invalid(true)
 , wrapped(false)
+, scanned(false)
+, contents(0)
+, linkscanned(false)
 {
 }
 
@@ -16,6 +19,27 @@ VTLine::VTLine(const VTLine& src, int)
 	static_cast<Vector<VTCell>&>(*this) = clone(static_cast<const Vector<VTCell>&>(src));
 	invalid = src.invalid;
 	wrapped = src.wrapped;
+	scanned = src.scanned;
+	contents = src.contents;
+	linkscanned = src.linkscanned;
+}
+
+dword VTLine::GetContents() const
+{
+	// The content flags are lazily rescanned after the line is invalidated.
+	// (Every mutation of the line's cells invalidates it.)
+
+	if(!scanned) {
+		VTCell c;
+		c.sgr = 0;
+		for(const VTCell& cell : *this)
+			c.sgr |= cell.sgr;
+		contents = (c.IsBlinking()  ? BLINKING  : 0)
+		         | (c.IsHypertext() ? HYPERTEXT : 0)
+		         | (c.IsImage()     ? IMAGE     : 0);
+		scanned = true;
+	}
+	return contents;
 }
 
 force_inline
@@ -24,7 +48,7 @@ void VTLine::Adjust(int cx, const VTCell& filler)
 	if(cx < GetCount())
 		wrapped = false;
 	SetCount(cx, filler);
-	invalid = true;
+	Invalidate();
 }
 
 force_inline
@@ -33,7 +57,7 @@ void VTLine::Grow(int cx, const VTCell& filler)
 	if(cx > GetCount()) {
 		wrapped = false;
 		SetCount(cx, filler);
-		invalid = true;
+		Invalidate();
 	}
 }
 
@@ -43,7 +67,7 @@ void VTLine::Shrink(int cx)
 	if(cx < GetCount()) {
 		wrapped = false;
 		SetCount(cx);
-		invalid = true;
+		Invalidate();
 	}
 }
 
@@ -52,7 +76,7 @@ void VTLine::ShiftLeft(int begin, int end, int n, const VTCell& filler)
 	Insert(end, filler, n);
 	Remove(begin - 1, n);
 	wrapped = false;
-	invalid = true;
+	Invalidate();
 }
 
 void VTLine::ShiftRight(int begin, int end, int n, const VTCell& filler)
@@ -60,14 +84,14 @@ void VTLine::ShiftRight(int begin, int end, int n, const VTCell& filler)
 	Insert(begin - 1, filler, n);
 	Remove(end, n);
 	wrapped = false;
-	invalid = true;
+	Invalidate();
 }
 
 bool VTLine::FillLeft(int begin, const VTCell& filler, dword flags)
 {
 	for(int i = 1; i <= clamp(begin, 1, GetCount()); i++)
 		At(i - 1).Fill(filler, flags);
-	invalid = true;
+	Invalidate();
 	return true;
 }
 
@@ -75,7 +99,7 @@ bool VTLine::FillRight(int begin, const VTCell& filler, dword flags)
 {
 	for(int i = max(1, begin); i <= GetCount(); i++)
 		At(i - 1).Fill(filler, flags);
-	invalid = true;
+	Invalidate();
 	return true;
 }
 
@@ -90,7 +114,7 @@ bool VTLine::Fill(int begin, int end, const VTCell& filler, dword flags)
 
 	bool done = b <= e;
 	if(done)
-		invalid = true;
+		Invalidate();
 	return done;
 }
 
@@ -98,7 +122,7 @@ bool VTLine::FillLine(const VTCell& filler, dword flags)
 {
 	for(VTCell& l : static_cast<Vector<VTCell>&>(*this))
 		l.Fill(filler, flags);
-	invalid = true;
+	Invalidate();
 	return true;
 }
 
@@ -172,6 +196,8 @@ VTPage::VTPage()
 , tabsize(8)
 , historysize(1024)
 , ambiguouscellwidth(1)
+, scrolldelta(0)
+, scrolltracking(false)
 , history(false)
 , autowrap(false)
 , reversewrap(false)
@@ -191,10 +217,25 @@ VTPage& VTPage::Reset()
 	Displaced(false);
 	ErasePage();
 	EraseHistory();
+	ClearSemanticMarks();
 	MoveTopLeft();
 	return *this;
 }
 
+VTPage& VTPage::Release()
+{
+	// Resets the page and frees the memory held by its lines.
+	// The lines are reallocated on the next resize.
+
+	for(const VTLine& line : lines)
+		DropLine(line);
+	lines.Clear();
+	SetSize(2, 2);
+	Reset();
+	lines.Shrink();
+	return *this;
+}
+
 VTPage& VTPage::Backup()
 {
 	backup = cursor;
@@ -261,8 +302,24 @@ VTPage& VTPage::History(bool b)
 	return *this;
 }
 
+static int64 sGetLineBytes(const VTLine& line)
+{
+	return sizeof(VTLine) + (int64) line.GetAlloc() * sizeof(VTCell);
+}
+
+void VTPage::AccountHistory(int64 delta)
+{
+	historybytes = max<int64>(0, historybytes + delta);
+	if(budget && delta)
+		budget->Account(delta);
+}
+
 void VTPage::EraseHistory()
 {
+	for(int i = 0; i < saved.GetCount() && !imagesdropped; i++)
+		DropLine(saved[i]);
+	lineorigin += saved.GetCount();
+	AccountHistory(-historybytes);
 	saved.Clear();
 	saved.Shrink();
 	lines.Shrink();
@@ -282,7 +339,14 @@ void VTPage::AdjustHistorySize(int n)
 	const int count = saved.GetCount() + n;
 	if(count > historysize) {
 		if(int ndrop = min (saved.GetCount(), count - historysize); ndrop > 0) {
+			int64 bytes = 0;
+			for(int i = 0; i < ndrop; i++) {
+				DropLine(saved[i]);
+				bytes += sGetLineBytes(saved[i]);
+			}
 			saved.DropHead(ndrop);
+			AccountHistory(-bytes);
+			lineorigin += ndrop;
 			LLOG("AdjustHistorySize() -> Before: " << count << ", after: " << saved.GetCount());
 		}
 	}
@@ -296,13 +360,36 @@ bool VTPage::SaveToHistory(int pos, int n)
 	if(n > historysize) {
 		start = n - historysize;
 		n = historysize;
+		lineorigin += start;
 	}
 	AdjustHistorySize(n);
+	int64 bytes = 0;
 	for(int i = start; i < start + n; i++)
-		saved.AddTail(pick(lines[pos - 1 + i]));
+		bytes += sGetLineBytes(saved.AddTail(pick(lines[pos - 1 + i])));
+	AccountHistory(bytes);
 	return true;
 }
 
+int64 VTPage::TrimHistory(int64 bytes)
+{
+	// Drops the oldest lines of the history buffer, until the requested amount of memory is freed.
+
+	int n = 0;
+	int64 freed = 0;
+	while(n < saved.GetCount() && freed < bytes) {
+		DropLine(saved[n]);
+		freed += sGetLineBytes(saved[n++]);
+	}
+	if(n > 0) {
+		saved.DropHead(n);
+		lineorigin += n;
+		AccountHistory(-freed);
+		LLOG("TrimHistory() -> lines: " << n << ", bytes: " << freed);
+		WhenUpdate();
+	}
+	return freed;
+}
+
 void VTPage::UnwindHistory(const Size& prevsize)
 {
 	int delta =  min(size.cy - prevsize.cy, saved.GetCount()), n = delta;
@@ -310,6 +397,7 @@ void VTPage::UnwindHistory(const Size& prevsize)
 		return;
 	lines.InsertN(0, delta);
 	while(delta-- > 0) {
+		AccountHistory(-sGetLineBytes(saved.Tail()));
 		lines[delta] = pick(saved.Tail());
 		saved.DropTail();
 	}
@@ -320,7 +408,7 @@ void VTPage::RewindHistory(const Size& prevsize)
 {
 	int delta = min(cursor.y - size.cy, lines.GetCount());
 	while(delta-- > 0) {
-		saved.AddTail(pick(lines[0]));
+		AccountHistory(sGetLineBytes(saved.AddTail(pick(lines[0]))));
 		lines.Remove(0, 1);
 	}
 }
@@ -346,6 +434,7 @@ VTPage& VTPage::SetSize(Size sz)
 		line.Grow(size.cx, cellattrs);
 		line.Invalidate();
 	}
+	scrolldelta = 0;
 	if(tabsync)
 		SetTabs(tabsize);
 	return MoveTo(cursor);
@@ -834,11 +923,14 @@ int VTPage::LineInsert(int pos, int n, const VTCell& attrs)
 			lines.InsertN(pos - 1, n);
 			for(int i = pos - 1; i < pos - 1 + n; i++)
 				lines[i].Adjust(size.cx, attrs);
+			for(int i = margins.bottom; i < margins.bottom + n; i++)
+				DropLine(lines[i]);
 			lines.Remove(margins.bottom, n);
 			scrolled = n;
 		}
 
-		Invalidate(pos - 1, margins.bottom);
+		if(!TrackScroll(pos, -n))
+			Invalidate(pos - 1, margins.bottom);
 		ClearEol();
 	}
 
@@ -871,19 +963,44 @@ int VTPage::LineRemove(int pos, int n, const VTCell& attrs)
 			lines.InsertN(margins.bottom, n);
 			for(int i = margins.bottom; i < margins.bottom + n; i++)
 				lines[i].Adjust(size.cx, attrs);
-			if(history && GetAbsRow(pos) == 1)
-				SaveToHistory(pos, n);
+			if(GetAbsRow(pos) == 1 && !(history && SaveToHistory(pos, n)) && margins == GetView())
+				lineorigin += n; // The lines are scrolled off the page.
+			for(int i = pos - 1; i < pos - 1 + n; i++)
+				DropLine(lines[i]); // The lines saved to the history are already moved.
 			lines.Remove(pos - 1, n);
 			scrolled = n;
 		}
 
-		Invalidate(pos - 1, margins.bottom);
+		if(!TrackScroll(pos, n))
+			Invalidate(pos - 1, margins.bottom);
 		ClearEol();
 	}
 
 	return scrolled;
 }
 
+bool VTPage::TrackScroll(int pos, int n)
+{
+	// Accumulates pure, full-page vertical scrolls (n > 0: up, n < 0: down) so that
+	// the view can blit the already painted lines and repaint only the exposed ones.
+	// Anything else (partial regions, mixed directions) falls back to invalidation.
+
+	if(!scrolltracking)
+		return false;
+
+	if(pos == 1
+	&& margins == GetView()
+	&& (scrolldelta == 0 || (scrolldelta > 0) == (n > 0))
+	&& abs(scrolldelta + n) < size.cy) {
+		scrolldelta += n;
+		return true;
+	}
+
+	if(scrolldelta != 0)
+		Invalidate();
+	return false;
+}
+
 VTPage& VTPage::ScrollUp(int n)
 {
 	if(LineInsert(margins.top, n, cellattrs) > 0)
@@ -1042,6 +1159,7 @@ VTPage& VTPage::EraseLine(dword flags)
 	LLOG("EraseLine(" << flags << ")");
 
 	VTLine& l = lines[cursor.y - 1];
+	DropLine(l);
 	l.FillLine(cellattrs, flags);
 	l.Unwrap();
 	ClearEol();
@@ -1053,6 +1171,7 @@ VTPage& VTPage::EraseLeft(dword flags)
 	LLOG("EraseLeft(" << flags << ")");
 
 	VTLine& l =	lines[cursor.y - 1];
+	DropLine(l);
 	l.FillLeft(cursor.x, cellattrs, flags);
 	l.Unwrap();
 	ClearEol();
@@ -1064,6 +1183,7 @@ VTPage& VTPage::EraseRight(dword flags)
 	LLOG("EraseRight(" << flags << ")");
 
 	VTLine& l =	lines[cursor.y - 1];
+	DropLine(l);
 	l.FillRight(cursor.x, cellattrs, flags);
 	l.Unwrap();
 	ClearEol();
@@ -1077,6 +1197,7 @@ VTPage& VTPage::ErasePage(dword flags)
 	Rect r = GetView();
 	for(int i = r.top; i <= r.bottom; i++) {
 		VTLine& l = lines[i - 1];
+		DropLine(l);
 		l.Shrink(size.cx);
 		l.FillLine(cellattrs, flags);
 		l.Unwrap();
@@ -1091,6 +1212,7 @@ VTPage& VTPage::EraseBefore(dword flags)
 
 	for(int i = 1; i < cursor.y; i++) {
 		VTLine& l =	lines[i - 1];
+		DropLine(l);
 		l.FillLine(cellattrs, flags);
 		l.Unwrap();
 	}
@@ -1103,6 +1225,7 @@ VTPage& VTPage::EraseAfter(dword flags)
 
 	for(int i = cursor.y + 1; i <= size.cy; i++) {
 		VTLine& l =  lines[i - 1];
+		DropLine(l);
 		l.FillLine(cellattrs, flags);
 		l.Unwrap();
 	}
@@ -1266,12 +1389,14 @@ void VTPage::FetchCellsMutable(Point pl, Point ph, Event<VTCell&> consumer)
 			for(int i = ptl.x; i < min(pth.x, line.GetCount() - 1); i++) {
 				consumer(const_cast<VTCell&>(line[i]));
 			}
+		line.Invalidate();
 	}
 	else {
 		for(int i = ptl.y; i <= pth.y; i++) {
 			const VTLine& line = FetchLine(i);
 			if(line.IsVoid())
 				continue;
+			line.Invalidate();
 			if(i == ptl.y) {
 				for(int j = ptl.x; j < line.GetCount(); j++)
 					consumer(const_cast<VTCell&>(line[j]));
@@ -1365,17 +1490,25 @@ bool VTPage::FetchRange(const Rect& r, Gate<int, const VTLine&, VTLine::ConstRan
 
 bool VTPage::FetchRange(int b, int e, Gate<VectorMap<int, VTLine>&> consumer) const
 {
-	VectorMap<int, VTLine> ln;
-	for(int i = b; i < e; i++) {
-		const VTLine& l = FetchLine(i);
-		if(!l.IsVoid()) {
-			ln.Add(i, clone(l));
-			if(!l.IsWrapped() || i == e - 1) {
-				if(consumer(ln))
-					return true;
-				ln.Clear();
-			}
-		}
+	return FetchLogicalLines(b, e, [&](const LogicalLineView& v) {
+		VectorMap<int, VTLine> ln;
+		for(int i = v.GetFirst(); i <= v.GetLast(); i++)
+			if(const VTLine& l = FetchLine(i); !l.IsVoid())
+				ln.Add(i, clone(l));
+		return !ln.IsEmpty() && consumer(ln);
+	});
+}
+
+bool VTPage::FetchLogicalLines(int b, int e, Gate<const LogicalLineView&> consumer) const
+{
+	// Logical lines are clipped to the [b, e) range.
+	b = max(b, 0);
+	e = min(e, GetLineCount());
+	for(int i = b, hi = i; i < e; i = ++hi) {
+		while(hi < e - 1 && FetchLine(hi).IsWrapped())
+			hi++;
+		if(consumer(LogicalLineView(*this, MakeTuple(i, hi))))
+			return true;
 	}
 	return false;
 }
@@ -1424,9 +1557,11 @@ void VTPage::RectCopy(const Point &p, const Rect& r, const Rect& rr, dword flags
 
 void VTPage::RectFill(const Rect& r, const VTCell& filler, dword flags)
 {
-	for(int i = r.top; i <= r.bottom; i++)
+	for(int i = r.top; i <= r.bottom; i++) {
+		DropLine(lines[i - 1]);
 		if(lines[i - 1].Fill(r.left, r.right, filler, flags))
 			ClearEol();
+	}
 }
 
 Rect VTPage::AdjustRect(const Rect& r, bool displaced)
@@ -1519,6 +1654,28 @@ VTPage& VTPage::FillStream(const Rect& r, dword chr)
 	return FillStream(r, filler, VTCell::FILL_NORMAL);
 }
 
+bool VTPage::EraseImages(Gate<dword> match)
+{
+	// Blanks the image cells on the screen that belong to the matching images.
+
+	bool erased = false;
+	for(VTLine& line : lines) {
+		if(!line.HasImages())
+			continue;
+		bool changed = false;
+		for(VTCell& cell : line)
+			if(cell.IsImage() && match(cell.chr)) {
+				cell.Clear();
+				changed = true;
+			}
+		if(changed) {
+			line.Invalidate();
+			erased = true;
+		}
+	}
+	return erased;
+}
+
 VTPage& VTPage::AddImage(Size sz, dword imageid, bool scroll, bool relpos)
 {
 	LTIMING("VTPage::AddImage");
@@ -1578,6 +1735,184 @@ void VTPage::Xmlize(XmlIO& xio)
 	XmlizeByJsonize(xio, *this);
 }
 
+static void sSerializeCellAttrs(Stream& s, VTCell& cell)
+{
+	int attrs = cell.attrs, sgr = cell.sgr;
+	s / cell.data;
+	s / attrs;
+	s / sgr;
+	s % cell.ink;
+	s % cell.paper;
+	cell.attrs = (word) attrs;
+	cell.sgr   = (word) sgr;
+}
+
+static bool sHasSameAttrs(const VTCell& a, const VTCell& b)
+{
+	return a.data  == b.data
+		&& a.attrs == b.attrs
+		&& a.sgr   == b.sgr
+		&& a.ink   == b.ink
+		&& a.paper == b.paper;
+}
+
+static void sSerializeLine(Stream& s, VTLine& line)
+{
+	// The cells are stored as runs of cells with the same attributes. The characters of
+	// a run are stored only once if they are also the same (e.g. trailing blanks).
+
+	int count = line.GetCount();
+	bool wrapped = line.IsWrapped();
+	s / count;
+	s % wrapped;
+
+	if(s.IsStoring()) {
+		for(int i = 0; i < count;) {
+			int j = i + 1;
+			bool samechr = true;
+			while(j < count && sHasSameAttrs(line[i], line[j])) {
+				samechr = samechr && line[j].chr == line[i].chr;
+				j++;
+			}
+			dword header = ((j - i) << 1) | samechr;
+			s / header;
+			sSerializeCellAttrs(s, line[i]);
+			for(int k = i; k < (samechr ? i + 1 : j); k++)
+				s / line[k].chr;
+			i = j;
+		}
+	}
+	else {
+		if(s.IsEof() || count < 0 || count > 65536) {
+			s.LoadError();
+			return;
+		}
+		line.SetCount(count);
+		for(int i = 0; i < count;) {
+			dword header = 0;
+			s / header;
+			int n = header >> 1;
+			if(n <= 0 || n > count - i) {
+				s.LoadError();
+				return;
+			}
+			VTCell cell;
+			sSerializeCellAttrs(s, cell);
+			s / cell.chr;
+			for(int k = 0; k < n; k++) {
+				if(k && !(header & 1))
+					s / cell.chr;
+				line[i++] = cell;
+			}
+		}
+		line.Wrap(wrapped);
+		line.Invalidate();
+	}
+}
+
+static void sSerializeCursor(Stream& s, int& x, int& y, bool& eol, bool& displaced)
+{
+	s / x / y;
+	s % eol % displaced;
+	if(s.IsLoading()) {
+		x = max(1, x);
+		y = max(1, y);
+	}
+}
+
+void VTPage::SerializeSnapshot(Stream& s)
+{
+	LTIMING("VTPage::SerializeSnapshot");
+
+	int version = 1;
+	s / version;
+	if(version < 1 || version > 1) {
+		s.LoadError();
+		return;
+	}
+
+	s % size;
+	s % margins;
+	s / tabsize;
+	s / historysize;
+	s / ambiguouscellwidth;
+	s % history;
+	s % autowrap;
+	s % reversewrap;
+	s % tabsync;
+	s % cellattrs;
+	s % lineorigin;
+
+	sSerializeCursor(s, cursor.x, cursor.y, cursor.eol, cursor.displaced);
+	sSerializeCursor(s, backup.x, backup.y, backup.eol, backup.displaced);
+
+	Vector<int> tabstops;
+	if(s.IsStoring())
+		GetTabs(tabstops);
+	s % tabstops;
+
+	// The counts read from the stream are not trusted: The entries are added one by one.
+	int count = semanticmarks.GetCount();
+	s / count;
+	if(s.IsLoading()) {
+		semanticmarks.Clear();
+		for(int i = 0; i < count && !s.IsError() && !s.IsEof(); i++) {
+			SemanticMark& m = semanticmarks.Add();
+			s % m.pos / m.type;
+		}
+	}
+	else
+		for(SemanticMark& m : semanticmarks)
+			s % m.pos / m.type;
+
+	// The history buffer and the page are streamed line by line.
+	int nsaved = saved.GetCount(), nlines = lines.GetCount();
+	s / nsaved / nlines;
+
+	if(s.IsStoring()) {
+		for(int i = 0; i < nsaved; i++)
+			sSerializeLine(s, saved[i]);
+		for(VTLine& line : lines)
+			sSerializeLine(s, line);
+		return;
+	}
+
+	if(size.cx < 1 || size.cy < 1 || size.cx > 65536 || size.cy > 65536 || nsaved < 0 || nlines != size.cy) {
+		s.LoadError();
+		return;
+	}
+
+	historysize = max(1, historysize);
+	ambiguouscellwidth = clamp(ambiguouscellwidth, 1, 2);
+
+	AccountHistory(-historybytes);
+	saved.Clear();
+	int64 bytes = 0;
+	for(int i = 0; i < nsaved && !s.IsError() && !s.IsEof(); i++) {
+		VTLine& line = saved.AddTail();
+		sSerializeLine(s, line);
+		bytes += sGetLineBytes(line);
+	}
+	AccountHistory(bytes);
+
+	lines.Clear();
+	lines.SetCount(nlines);
+	for(int i = 0; i < nlines && !s.IsError(); i++)
+		sSerializeLine(s, lines[i]);
+
+	tabs.Clear();
+	for(int col : tabstops)
+		tabs.Set(col, true);
+
+	scrolldelta = 0;
+	AdjustHistorySize();
+	if(!GetView().Contains(margins))
+		ResetMargins();
+	cursor.x = min(cursor.x, size.cx);
+	cursor.y = min(cursor.y, size.cy);
+	WhenUpdate();
+}
+
 String VTPage::Cursor::ToString() const
 {
 	return Format(
@@ -1605,6 +1940,167 @@ Tuple<int, int> VTPage::GetLineSpan(int i, int limit) const
 
 }
 
+VTPage& VTPage::AddSemanticMark(int type)
+{
+	LLOG("AddSemanticMark(" << type << ")");
+
+	Point pt = GetPos();
+	int64 pos = ((lineorigin + pt.y - 1) << 16) | clamp(pt.x - 1, 0, 0xFFFF);
+
+	// Drop the marks of the lines that are no longer in the buffer, and the marks that are
+	// past the cursor (e.g. the screen is cleared and the cursor is moved home).
+	int n = 0;
+	while(n < semanticmarks.GetCount() && (semanticmarks[n].pos >> 16) < lineorigin)
+		n++;
+	if(n)
+		semanticmarks.Remove(0, n);
+	while(!semanticmarks.IsEmpty() && semanticmarks.Top().pos > pos)
+		semanticmarks.Drop();
+
+	SemanticMark& m = semanticmarks.Add();
+	m.pos  = pos;
+	m.type = type;
+	return *this;
+}
+
+Point VTPage::FindSemanticMark(Point pt, int type, bool next) const
+{
+	// Returns the position of the nearest mark of given type (any type, if negative) that
+	// follows or precedes pt, or Null. Marks are kept sorted, so this is a binary search.
+
+	int64 key = ((lineorigin + pt.y) << 16) | clamp(pt.x, 0, 0xFFFF);
+
+	int lo = 0, hi = semanticmarks.GetCount();
+	while(lo < hi) {
+		int m = (lo + hi) >> 1;
+		int64 p = semanticmarks[m].pos;
+		if(next ? p <= key : p < key)
+			lo = m + 1;
+		else
+			hi = m;
+	}
+
+	auto ToPoint = [&](const SemanticMark& m) {
+		return Point((int)(m.pos & 0xFFFF), (int)((m.pos >> 16) - lineorigin));
+	};
+
+	if(next) {
+		for(int i = lo; i < semanticmarks.GetCount(); i++) {
+			Point q = ToPoint(semanticmarks[i]);
+			if(q.y >= GetLineCount())
+				break;
+			if(q.y >= 0 && (type < 0 || semanticmarks[i].type == type))
+				return q;
+		}
+	}
+	else {
+		for(int i = lo - 1; i >= 0; i--) {
+			Point q = ToPoint(semanticmarks[i]);
+			if(q.y < 0)
+				break;
+			if(q.y < GetLineCount() && (type < 0 || semanticmarks[i].type == type))
+				return q;
+		}
+	}
+
+	return Null;
+}
+
+LogicalLineView::LogicalLineView(const VTPage& page, int i, int limit)
+: LogicalLineView(page, page.GetLineSpan(i, limit))
+{
+}
+
+LogicalLineView::LogicalLineView(const VTPage& page, Tuple<int, int> span)
+: page(&page)
+, first(max(span.a, 0))
+, last(min(span.b, page.GetLineCount() - 1))
+, row(first)
+{
+	for(int i = first; i <= last; i++)
+		count += page.FetchLine(i).GetCount();
+}
+
+void LogicalLineView::Seek(int col) const
+{
+	if(col < offset) {
+		row = first;
+		offset = 0;
+	}
+	while(row < last) {
+		int n = page->FetchLine(row).GetCount();
+		if(col < offset + n)
+			break;
+		offset += n;
+		row++;
+	}
+}
+
+const VTCell& LogicalLineView::Get(int col) const
+{
+	if(col < 0 || col >= count)
+		return VTCell::Void();
+	Seek(col);
+	return page->FetchLine(row)[col - offset];
+}
+
+Point LogicalLineView::GetPos(int col) const
+{
+	if(!page || last < first)
+		return Null;
+	col = clamp(col, 0, count);
+	Seek(col);
+	return Point(col - offset, row);
+}
+
+int LogicalLineView::GetColumn(const Point& pt) const
+{
+	if(!page || pt.y < first || pt.y > last)
+		return -1;
+	int col = pt.x;
+	for(int i = first; i < pt.y; i++)
+		col += page->FetchLine(i).GetCount();
+	return col;
+}
+
+WString LogicalLineView::ToWString(bool tspaces) const
+{
+	WString txt;
+	for(int i = first; i <= last; i++) {
+		const VTLine& line = page->FetchLine(i);
+		txt << AsWString(SubRange(line.Begin(), line.End()), tspaces);
+	}
+	return txt;
+}
+
+LogicalLineView::Iterator LogicalLineView::begin() const
+{
+	Iterator q;
+	if(!count)
+		return q;
+	q.page = page;
+	q.y    = first;
+	q.last = last;
+	q.line = &page->FetchLine(first);
+	while(q.line->IsEmpty() && q.y < last) // Skip empty lines.
+		q.line = &page->FetchLine(++q.y);
+	return q;
+}
+
+LogicalLineView::Iterator& LogicalLineView::Iterator::operator++()
+{
+	col++;
+	if(++x >= line->GetCount()) {
+		while(y < last) {
+			line = &page->FetchLine(++y);
+			x = 0;
+			if(!line->IsEmpty())
+				break;
+		}
+	}
+	return *this;
+}
+
 WString AsWString(const VTPage& page, const Rect& r, bool rectsel, bool tspaces)
 {
 	Vector<WString> v;
@@ -1647,4 +2143,78 @@ int GetOffset(const VTPage& page, int begin, int end)
 	return offset;
 }
 
-}
\ No newline at end of file
+VTPage& VTPage::SetHistoryBudget(VTHistoryBudget *b)
+{
+	if(budget != b) {
+		if(budget)
+			budget->Detach(*this);
+		budget = b;
+		if(budget)
+			budget->Attach(*this);
+	}
+	return *this;
+}
+
+void VTPage::MarkViewed()
+{
+	if(budget)
+		viewtick = ++budget->tick;
+}
+
+VTHistoryBudget::~VTHistoryBudget()
+{
+	for(VTPage *p : pages)
+		p->budget = nullptr;
+}
+
+VTHistoryBudget& VTHistoryBudget::SetLimit(int64 bytes)
+{
+	limit = max<int64>(0, bytes);
+	if(usage > limit)
+		Trim();
+	return *this;
+}
+
+void VTHistoryBudget::Attach(VTPage& p)
+{
+	pages.Add(&p);
+	p.viewtick = ++tick;
+	Account(p.GetHistoryBytes());
+}
+
+void VTHistoryBudget::Detach(VTPage& p)
+{
+	for(int i = 0; i < pages.GetCount(); i++)
+		if(pages[i] == &p) {
+			pages.Remove(i);
+			usage = max<int64>(0, usage - p.GetHistoryBytes());
+			break;
+		}
+}
+
+void VTHistoryBudget::Account(int64 delta)
+{
+	usage = max<int64>(0, usage + delta);
+}
+
+void VTHistoryBudget::Trim()
+{
+	LTIMING("VTHistoryBudget::Trim");
+
+	// The least recently viewed pages lose their oldest lines first. The usage is brought
+	// a bit below the limit, so that a page at the limit doesn't trigger a trim per line.
+
+	int64 target = limit - limit / 16;
+	Vector<VTPage*> order = clone(pages);
+	StableSort(order, [](const VTPage *a, const VTPage *b) { return a->viewtick < b->viewtick; });
+
+	for(VTPage *p : order) {
+		if(usage <= target)
+			break;
+		p->TrimHistory(usage - target);
+	}
+
+	LLOG("VTHistoryBudget::Trim() -> usage: " << usage << ", limit: " << limit);
+}
+
+}
@@ -21,10 +21,25 @@ public:
     bool            FillRight(int begin, const VTCell& filler, dword flags = 0);
     bool            FillLine(const VTCell& filler, dword flags = 0);
 
-    void            Validate(bool b = true)  const          { invalid = !b;    }
-    void            Invalidate() const                      { invalid = true;  }
+    void            Validate(bool b = true)  const          { if(b) invalid = false; else Invalidate(); }
+    void            Invalidate() const                      { invalid = true; scanned = false; linkscanned = false; }
     bool            IsInvalid() const                       { return invalid;  }
 
+    // Plain-text link detection state. (Every mutation of the line resets it.)
+    void            LinksScanned(bool b = true) const       { linkscanned = b; }
+    bool            IsLinksScanned() const                  { return linkscanned; }
+
+    enum Contents : dword {
+        BLINKING    = 1 << 0,
+        HYPERTEXT   = 1 << 1,
+        IMAGE       = 1 << 2
+    };
+
+    dword           GetContents() const;
+    bool            HasBlinkingCells() const                { return GetContents() & BLINKING;  }
+    bool            HasHypertext() const                    { return GetContents() & HYPERTEXT; }
+    bool            HasImages() const                       { return GetContents() & IMAGE;     }
+
     void            Wrap(bool b = true) const               { wrapped = b;     }
     void            Unwrap() const                          { wrapped = false; }
     bool            IsWrapped() const                       { return wrapped;  }
@@ -44,12 +59,18 @@ public:
 private:
     mutable bool invalid:1;
     mutable bool wrapped:1;
+    mutable bool scanned:1;
+    mutable byte contents:3;
+    mutable bool linkscanned:1;
 };
 
 WString AsWString(VTLine::ConstRange& cellrange, bool tspaces = true);
 int     GetLength(const VTLine& line, int begin, int end);
 int     GetOffset(const VTLine& line, int begin, int end);
 
+class LogicalLineView;
+class VTHistoryBudget;
+
 class VTPage : Moveable<VTPage> {
     struct Cursor
     {
@@ -85,7 +106,7 @@ public:
 
     VTPage();
     VTPage(Size sz) : VTPage()                              { SetSize(sz); }
-    virtual ~VTPage()                                       {}
+    virtual ~VTPage()                                       { SetHistoryBudget(nullptr); }
 
     Event<>         WhenUpdate;
     
@@ -107,11 +128,23 @@ public:
     void            EraseHistory();
     void            SetHistorySize(int sz);
     int             GetHistorySize() const                  { return historysize; };
+    int64           GetHistoryBytes() const                 { return historybytes; }
+    int64           TrimHistory(int64 bytes);
+
+    // Set when lines with images are erased or dropped, so that the images can be released.
+    bool            HasDroppedImages() const                { return imagesdropped; }
+    void            ClearDroppedImages()                    { imagesdropped = false; }
+
+    // Pages can share a byte budget for their history buffers.
+    VTPage&         SetHistoryBudget(VTHistoryBudget *b);
+    VTHistoryBudget *GetHistoryBudget() const               { return budget; }
+    void            MarkViewed();
 
     VTPage&         Attributes(const VTCell& attrs)         { cellattrs = attrs; return *this; }
     const VTCell&   GetAttributes() const                   { return cellattrs; }
 
     VTPage&         Reset();
+    VTPage&         Release();
 
     VTPage&         Backup();
     VTPage&         Discard();
@@ -206,6 +239,7 @@ public:
     VTPage&         FillStream(const Rect& r, dword chr);
 
     VTPage&         AddImage(Size sz, dword imageid, bool scroll, bool relpos = false);
+    bool            EraseImages(Gate<dword> match);
 
     VTPage&         SetTabAt(int col, bool b = true)         { SetTabStop(col, b); return *this; }
     VTPage&         SetTab(bool b = true)                    { SetTabStop(cursor.x, b); return *this; }
@@ -219,9 +253,15 @@ public:
     void            ClearEol()                               { cursor.eol = false; }
     bool            IsEol() const                            { return cursor.eol;  }
 
-    void            Invalidate()                             { for(auto& line : lines) line.Invalidate(); }
+    void            Invalidate()                             { for(auto& line : lines) line.Invalidate(); scrolldelta = 0; }
     void            Invalidate(int begin, int end);
 
+    // Full-page vertical scrolls can be accumulated (as line deltas) instead of invalidating the moved lines.
+    VTPage&         TrackScrolls(bool b = true)              { scrolltracking = b; scrolldelta = 0; return *this; }
+    bool            IsTrackingScrolls() const                { return scrolltracking; }
+    int             GetScrollDelta() const                   { return scrolldelta; }
+    void            ClearScrollDelta()                       { scrolldelta = 0; }
+
     // Index: 0-based.
     int             GetLineCount() const                     { return lines.GetCount() + saved.GetCount(); }
     Tuple<int, int> GetLineSpan(int i, int limit = 0) const;
@@ -241,6 +281,13 @@ public:
     bool            FetchRange(const Rect& r, RangeCallback consumer, bool rect = false) const;
     bool            FetchRange(int begin, int end, Gate<VectorMap<int, VTLine>&> consumer) const;
     bool            FetchRange(Tuple<int, int> range, Gate<VectorMap<int, VTLine>&> consumer) const;
+    bool            FetchLogicalLines(int begin, int end, Gate<const LogicalLineView&> consumer) const;
+
+    // Semantic (OSC 133) marks. Positions are 0-based page coordinates.
+    VTPage&         AddSemanticMark(int type);
+    Point           FindSemanticMark(Point pt, int type = -1, bool next = false) const;
+    int             GetSemanticMarkCount() const             { return semanticmarks.GetCount(); }
+    void            ClearSemanticMarks()                     { semanticmarks.Clear(); }
 
     // TODO: Add a complete set of mutating fetchers.
        
@@ -253,6 +300,9 @@ public:
     virtual void    Jsonize(JsonIO& jio);
     virtual void    Xmlize(XmlIO& xio);
 
+    // Session snapshots: The complete page state, including the cells of the history buffer.
+    void            SerializeSnapshot(Stream& s);
+
 private:
     bool            HorzMarginsExist() const                                        { return margins.Width()  < size.cx - 1; }
     bool            VertMarginsExist() const                                        { return margins.Height() < size.cy - 1; }
@@ -273,7 +323,10 @@ private:
     int             CellRemove(int pos, int n, const VTCell& attrs, bool pan);
     int             SetTabStop(int col, bool b);
     bool            IsTabStop(int col) const                                        { return tabs[col]; }
+    bool            TrackScroll(int pos, int n);
     void            AdjustHistorySize(int n = 0);
+    void            AccountHistory(int64 delta);
+    void            DropLine(const VTLine& line)            { if(line.HasImages()) imagesdropped = true; }
     bool            SaveToHistory(int pos, int n);
     void            UnwindHistory(const Size& prevsize);
     void            RewindHistory(const Size& prevsize);
@@ -293,11 +346,118 @@ private:
     int             tabsize;
     int             historysize;
     int             ambiguouscellwidth;
+    int             scrolldelta;
+    bool            scrolltracking;
     bool            history;
     bool            autowrap;
     bool            reversewrap;
     bool            tabsync;
     VTCell          cellattrs;
+
+    // A semantic mark's position is packed as (absolute line << 16) | column, so that the
+    // marks stay valid as the lines move into the history buffer and out of it.
+    struct SemanticMark : Moveable<SemanticMark> {
+        int64       pos;
+        int         type;
+    };
+
+    Vector<SemanticMark> semanticmarks;
+    int64           lineorigin = 0; // The absolute number of the first line.
+
+    friend class VTHistoryBudget;
+    VTHistoryBudget *budget = nullptr;
+    int64           historybytes = 0;
+    int64           viewtick = 0;
+    bool            imagesdropped = false;
+};
+
+// A byte budget shared by the history buffers of multiple pages (e.g. of all the terminals in
+// a process). When the budget is exceeded, the least recently viewed pages are trimmed first.
+// The budget and its pages are expected to be used from the same thread.
+
+class VTHistoryBudget : NoCopy {
+public:
+    VTHistoryBudget(int64 bytes = 1024 * 1024 * 256)        { limit = max<int64>(0, bytes); }
+    ~VTHistoryBudget();
+
+    VTHistoryBudget& SetLimit(int64 bytes);
+    int64           GetLimit() const                        { return limit; }
+    int64           GetUsage() const                        { return usage; }
+    int             GetPageCount() const                    { return pages.GetCount(); }
+
+    // The pages are not trimmed while they are being modified: The owner of a page calls
+    // Trim() when it is done with its page operations (e.g. after parsing).
+    bool            IsExceeded() const                      { return usage > limit; }
+    void            Trim();
+
+private:
+    friend class VTPage;
+    void            Attach(VTPage& p);
+    void            Detach(VTPage& p);
+    void            Account(int64 delta);
+
+    Vector<VTPage*> pages;
+    int64           limit    = 0;
+    int64           usage    = 0;
+    int64           tick     = 0;
+};
+
+// A non-owning view of a logical line, i.e. of the physical lines joined by wrapping.
+// Cells are accessed in place by their logical column. The view is invalidated when the page changes.
+
+class LogicalLineView {
+public:
+    LogicalLineView()                                       {}
+    LogicalLineView(const VTPage& page, int i, int limit = 0);
+    LogicalLineView(const VTPage& page, Tuple<int, int> span);
+
+    int             GetFirst() const                        { return first; }
+    int             GetLast() const                         { return last;  }
+    int             GetLineCount() const                    { return last - first + 1; }
+    const VTLine&   GetLine(int i) const                    { return page ? page->FetchLine(first + i) : VTLine::Void(); }
+
+    int             GetCount() const                        { return count; }
+    bool            IsEmpty() const                         { return count == 0; }
+
+    const VTCell&   Get(int col) const;
+    const VTCell&   operator[](int col) const               { return Get(col); }
+
+    Point           GetPos(int col) const;
+    int             GetColumn(const Point& pt) const;
+
+    WString         ToWString(bool tspaces = true) const;
+
+    class Iterator {
+    public:
+        const VTCell&   operator*() const                   { return (*line)[x]; }
+        const VTCell*   operator->() const                  { return &(*line)[x]; }
+        Iterator&       operator++();
+        bool            operator==(const Iterator& q) const { return col == q.col; }
+        bool            operator!=(const Iterator& q) const { return col != q.col; }
+
+        int             GetColumn() const                   { return col; }
+        Point           GetPos() const                      { return Point(x, y); }
+        const VTLine&   GetLine() const                     { return *line; }
+
+    private:
+        friend class LogicalLineView;
+        const VTPage   *page = nullptr;
+        const VTLine   *line = nullptr;
+        int             x = 0, y = 0, last = 0, col = 0;
+    };
+
+    Iterator        begin() const;
+    Iterator        end() const                             { Iterator q; q.col = count; return q; }
+
+private:
+    void            Seek(int col) const;
+
+    const VTPage   *page   = nullptr;
+    int             first  = 0;
+    int             last   = -1;
+    int             count  = 0;
+    mutable int     row    = 0;     // The physical line of the last lookup,
+    mutable int     offset = 0;     // and its logical column.
 };
 
 WString AsWString(const VTPage& page, const Rect& r, bool rectsel = false, bool tspaces = true);
@@ -5,6 +5,10 @@
 
 namespace Upp {
 
+// Very long logical lines are matched against the highlight rules in windows of this many
+// physical lines.
+static constexpr int sMaxHighlightSpan = 64;
+
 struct CellPaintData : Moveable<CellPaintData> {
 	Point pos   = {0, 0};
 	Size  size  = {0, 0};
@@ -252,6 +256,8 @@ void TerminalCtrl::Paint0(Draw& w, bool print)
 
 	Color bkg = colortable[COLOR_PAPER];
 
+	SyncPalette();
+
 	CellPaintData cpd;
 	cpd.size = csz;
 	Vector<CellPaintData> linepaintdata(psz.cx, cpd);
@@ -265,9 +271,8 @@ void TerminalCtrl::Paint0(Draw& w, bool print)
 		return MakeTuple(-1, -1);
 	};
 
-	auto PaintLine = [&](const VTLine& line, int i) {
+	auto PaintLine = [&](Draw& w, const VTLine& line, int i, int y) {
 		LTIMING("TerminalCtrl::PaintLine");
-		int y = i * csz.cy - (csz.cy * pos);
 		auto selrange = GetSelectionRange(i);
 		{
 			// Render the background rectangles.
@@ -285,13 +290,8 @@ void TerminalCtrl::Paint0(Draw& w, bool print)
 					data.ink = colortable[COLOR_INK_SELECTED];
 					data.paper = colortable[COLOR_PAPER_SELECTED];
 				}
-				else {
-					SetInkAndPaperColor(cell, data.ink, data.paper);
-					if(dim) {
-						data.ink = Blend(data.ink, Black(), dimalpha);
-						data.paper = Blend(data.paper, Black(), dimalpha);
-					}
-				}
+				else
+					SetInkAndPaperColor(cell, data.ink, data.paper, dim);
 				data.pos = {x, y};
 				if(j == psz.cx - 1)
 					data.size.cx = wsz.cx - x;
@@ -329,27 +329,116 @@ void TerminalCtrl::Paint0(Draw& w, bool print)
 		}
 	};
 
+	// Lines with images are not cached, as their contents depend on the image cache.
+	// Lines passed to WhenHighlight are not cached, as the client can modify them arbitrarily.
+	bool cacheable = linecache && !print && !nobackground && !(highlight && WhenHighlight);
+	dword cacheflags = lightcolors
+		| (intensify << 1)
+		| (modes[DECSCNM] << 2)
+		| (hyperlinks << 3)
+		| (annotations << 4)
+		| (dim << 5);
+
+	auto PaintCachedLine = [&](const VTLine& line, int i) {
+		int y = i * csz.cy - (csz.cy * pos);
+		if(!cacheable || line.HasImages()) {
+			PaintLine(w, line, i, y);
+			return;
+		}
+		LTIMING("TerminalCtrl::PaintCachedLine");
+		// The key holds the inputs themselves, so a hash collision can't return a wrong raster.
+		StringBuffer kb;
+		kb.Cat((const char *) line.begin(), line.GetCount() * sizeof(VTCell));
+		RawCat(kb, font);
+		RawCat(kb, padding);
+		RawCat(kb, csz);
+		RawCat(kb, wsz.cx);
+		RawCat(kb, palettegen);
+		RawCat(kb, cacheflags | ((blinking && line.HasBlinkingCells()) << 6));
+		RawCat(kb, GetSelectionRange(i));
+		RawCat(kb, line.HasHypertext() ? activehtext : 0);
+		if(line.GetCount() < psz.cx)
+			RawCat(kb, GetAttrs());
+		String key = kb;
+		int q = linerasters.Find(key);
+		if(q < 0) {
+			ImageDraw iw(wsz.cx, csz.cy);
+			iw.DrawRect(0, 0, wsz.cx, csz.cy, bkg);
+			PaintLine(iw, line, i, 0);
+			if(linerasters.GetCount() >= max(2 * psz.cy, 64))
+				linerasters.Remove(0);
+			q = linerasters.GetCount();
+			linerasters.Add(key, Image(iw));
+		}
+		w.DrawImage(0, y, linerasters[q]);
+	};
+
 	if(!nobackground)
 		w.DrawRect(wsz, bkg);
 
 	auto range = GetPageRange();
 
-	if(highlight) {
+	// Resolves the cached highlight spans of the logical line containing the physical line i.
+	// Consecutive physical lines of the same logical line share a single lookup.
+	bool hlrules = highlight && highlightrules.GetCount();
+	Tuple<int, int> hlspan(-1, -1);
+	const Vector<HighlightSpan> *hlspans = nullptr;
+
+	auto Highlight = [&](VTLine& line, int i, const VTLine *src = nullptr) -> bool {
+		if(!hlrules)
+			return false;
+		if(!hlspans || i < hlspan.a || i > hlspan.b) {
+			hlspan = page->GetLineSpan(i, sMaxHighlightSpan);
+			hlspans = &GetHighlightSpans(hlspan.a, hlspan.b);
+		}
+		bool done = false;
+		for(const HighlightSpan& span : *hlspans) {
+			if(span.row != i - hlspan.a)
+				continue;
+			if(!done && src)
+				line = clone(*src);
+			done = true;
+			const HighlightRule& rule = highlightrules[span.rule];
+			for(int j = span.begin; j < min(span.end, line.GetCount()); j++) {
+				VTCell& cell = line[j];
+				if(!IsNull(rule.ink))
+					cell.ink = rule.ink;
+				if(!IsNull(rule.paper))
+					cell.paper = rule.paper;
+			}
+		}
+		return done;
+	};
+
+	if(highlight && WhenHighlight) {
 		LTIMING("TerminalCtrl::WhenHighlight");
-		page->FetchRange(range.a, range.b, [&](VectorMap<int, VTLine>& hl) {
+		// Only the logical lines that intersect the clip region are passed to the client.
+		page->FetchLogicalLines(range.a, range.b, [&](const LogicalLineView& v) {
+			if(!w.IsPainting(0, v.GetFirst() * csz.cy - (csz.cy * pos), wsz.cx, v.GetLineCount() * csz.cy))
+				return false;
+			VectorMap<int, VTLine> hl;
+			for(int n = 0; n < v.GetLineCount(); n++)
+				hl.Add(v.GetFirst() + n, clone(v.GetLine(n)));
 			WhenHighlight(hl);
-			for(const auto& h : ~hl)
-				PaintLine(h.value, h.key);
+			for(int q = 0; q < hl.GetCount(); q++) {
+				int n = hl.GetKey(q);
+				int y = n * csz.cy - (csz.cy * pos);
+				if(!w.IsPainting(0, y, wsz.cx, csz.cy))
+					continue;
+				Highlight(hl[q], n);
+				PaintLine(w, hl[q], n, y);
+			}
 			return false;
 		});
 	}
 	else {
+		VTLine hl;
 		for(int i = range.a; i < range.b; i++) {
 			int y = i * csz.cy - (csz.cy * pos);
 			if(!w.IsPainting(0, y, wsz.cx, csz.cy))
 				continue;
 			if(const VTLine& line = page->FetchLine(i); !line.IsVoid())
-				PaintLine(line, i);
+				PaintCachedLine(Highlight(hl, i, &line) ? hl : line, i);
 		}
 
 	}
@@ -385,12 +474,99 @@ void TerminalCtrl::PaintSizeHint(Draw& w)
 	w.DrawImage(rr.left, rr.top, ip.GetResult());
 }
 
+const Vector<TerminalCtrl::HighlightSpan>& TerminalCtrl::GetHighlightSpans(int lo, int hi)
+{
+	// The matches are keyed by the text of the logical line (and its layout), so only the
+	// lines that have changed since the last paint are re-evaluated. The key holds the text
+	// itself, so a hash collision can't return the matches of another line.
+
+	LogicalLineView v(*page, MakeTuple(lo, hi));
+
+	StringBuffer kb;
+	RawCat(kb, highlightgen);
+	for(int i = 0; i < v.GetLineCount(); i++) {
+		const VTLine& line = v.GetLine(i);
+		RawCat(kb, line.GetCount());
+		for(const VTCell& cell : line) {
+			RawCat(kb, cell.chr);
+			kb.Cat(cell.IsWideCharTrail() | (cell.IsImage() << 1));
+		}
+	}
+
+	String key = kb;
+	int q = highlightcache.Find(key);
+	if(q < 0) {
+		if(highlightcache.GetCount() >= max(4 * GetPageSize().cy, 256))
+			highlightcache.Remove(0);
+		q = highlightcache.GetCount();
+		highlightcache.Add(key, EvaluateHighlightRules(v));
+	}
+	return highlightcache[q];
+}
+
+Vector<TerminalCtrl::HighlightSpan> TerminalCtrl::EvaluateHighlightRules(const LogicalLineView& v)
+{
+	LTIMING("TerminalCtrl::EvaluateHighlightRules");
+
+	// Flatten the logical line into UTF-8 text, mapping each byte to its cell.
+	String text;
+	Vector<Point> cells;
+	for(auto q = v.begin(); q != v.end(); ++q) {
+		const VTCell& cell = *q;
+		if(cell.IsWideCharTrail())
+			continue;
+		if(cell.chr < 32 || cell.IsImage())
+			text.Cat(' ');
+		else
+			text.Cat(ToUtf8((wchar) cell.chr));
+		while(cells.GetCount() < text.GetLength())
+			cells.Add(Point(q.GetPos().x, q.GetPos().y - v.GetFirst()));
+	}
+
+	Vector<HighlightSpan> spans;
+
+	auto AddSpan = [&](int rule, int begin, int end) {
+		Point a = cells[begin], b = cells[end - 1];
+		for(int row = a.y; row <= b.y; row++) {
+			HighlightSpan& span = spans.Add();
+			span.row   = row;
+			span.begin = row == a.y ? a.x : 0;
+			span.end   = row == b.y ? b.x + 1 : INT_MAX;
+			span.rule  = rule;
+		}
+	};
+
+	for(int r = 0; r < highlightrules.GetCount(); r++) {
+		HighlightRule& rule = highlightrules[r];
+		if(rule.regex) {
+			// Successive matches are searched in the whole line, from the end of the previous
+			// match, so that anchors and lookbehind assertions see the preceding text.
+			// There can be at most one match per byte (plus an empty one at the end).
+			RegExp& re = *rule.regex;
+			re.ResetGlobal();
+			for(int i = 0; i <= text.GetLength() && re.GlobalMatch(~text); i++) {
+				int n = re.GetLength();
+				if(n > 0)
+					AddSpan(r, re.GetOffset(), re.GetOffset() + n);
+			}
+		}
+		else {
+			int n = rule.pattern.GetLength();
+			for(int p = text.Find(rule.pattern); p >= 0; p = text.Find(rule.pattern, p + n))
+				AddSpan(r, p, p + n);
+		}
+	}
+
+	return spans;
+}
+
 void TerminalCtrl::PaintImages(Draw& w, ImageParts& parts, const Size& csz)
 {
 	LTIMING("TerminalCtrl::PaintImages");
 
 	InlineImage im;
 	dword lastid = -1;
+	bool pending = false;
 
 	for(const ImagePart& part : parts) {
 		const dword& id = part.a;
@@ -399,6 +575,9 @@ void TerminalCtrl::PaintImages(Draw& w, ImageParts& parts, const Size& csz)
 		Rect r(pt, rr.GetSize());
 		if(id != lastid) { // Optimization: cached inline-image to reduce mutex locking.
 			im = GetCachedImageData(id, Null, csz);
+			pending = IsNull(im.image) && IsImagePending(id);
+			if(prescaleimages && !IsNull(im.image))
+				im.image = GetScaledImage(id, im, csz);
 			lastid = id;
 		}
 		if(!IsNull(im.image)) {
@@ -406,7 +585,80 @@ void TerminalCtrl::PaintImages(Draw& w, ImageParts& parts, const Size& csz)
 			im.fontsize  = csz;    // Keep it updated.
 			imgdisplay->Paint(w, r, im, colortable[COLOR_INK], colortable[COLOR_PAPER], 0);
 		}
+		else
+		if(pending) // Placeholder.
+			w.DrawRect(r, Blend(colortable[COLOR_PAPER], colortable[COLOR_INK], 32));
+	}
+}
+
+Image TerminalCtrl::GetScaledImage(dword id, const InlineImage& im, const Size& csz)
+{
+	// Returns the image rescaled to its cell area. The rescaled variants are kept
+	// per terminal and dropped when the cell size changes.
+
+	LTIMING("TerminalCtrl::GetScaledImage");
+
+	if(scaledsize != csz) {
+		scaledimages.Clear();
+		scaledsize = csz;
+	}
+
+	Size sz = im.cellsize * csz;
+	if(im.image.GetSize() == sz)
+		return im.image;
+	if(int i = scaledimages.Find(id); i >= 0 && scaledimages[i].GetSize() == sz)
+		return scaledimages[i];
+	if(scaledimages.GetCount() >= 256)
+		scaledimages.Clear();
+	return scaledimages.GetAdd(id) = Rescale(im.image, sz);
+}
+
+void TerminalCtrl::PrescaleImages()
+{
+	// Rescales the visible images in parallel when the cell size changes,
+	// so that the following paint finds them ready.
+
+	if(!prescaleimages)
+		return;
+
+	Size csz = GetCellSize();
+	if(scaledsize == csz)
+		return;
+
+	LTIMING("TerminalCtrl::PrescaleImages");
+
+	scaledimages.Clear();
+	scaledsize = csz;
+
+	Index<dword> ids;
+	auto range = GetPageRange();
+	for(int i = range.a; i < range.b; i++) {
+		const VTLine& line = page->FetchLine(i);
+		if(line.IsVoid() || !line.HasImages())
+			continue;
+		for(int j = 0; j < line.GetCount(); j++)
+			if(line[j].IsImage())
+				ids.FindAdd(line[j].chr);
+	}
+
+	Vector<dword> keys;
+	Vector<InlineImage> images;
+	for(dword id : ids) {
+		InlineImage im = GetCachedImageData(id, Null, csz);
+		if(!IsNull(im.image) && im.image.GetSize() != im.cellsize * csz) {
+			keys.Add(id);
+			images.Add(pick(im));
+		}
 	}
+
+	Vector<Image> scaled;
+	scaled.SetCount(images.GetCount());
+	CoFor(images.GetCount(), [&](int i) {
+		scaled[i] = Rescale(images[i].image, images[i].cellsize * csz);
+	});
+
+	for(int i = 0; i < keys.GetCount(); i++)
+		scaledimages.Add(keys[i], pick(scaled[i]));
 }
 
 void TerminalCtrl::CollectImage(ImageParts& ip, int x, int y, const VTCell& cell, const Size& sz)
@@ -426,72 +678,313 @@ void TerminalCtrl::CollectImage(ImageParts& ip, int x, int y, const VTCell& cell
 	ip.Add(MakeTuple(id, coords, ir));
 }
 
-void TerminalCtrl::RenderImage(const ImageString& imgs, bool scroll)
+dword TerminalCtrl::RenderImage(const ImageString& imgs, bool scroll, const Image& decoded)
 {
+	// Returns the image id of the placed cells, or 0 if nothing is placed.
+
 	bool encoded = !imgs.IsSixel(); // Sixel images are not base64 encoded.
 
 	if(WhenImage) {
-		WhenImage(encoded ? Base64Decode(imgs.data) : imgs.data);
-		return;
+		WhenImage(imgs.IsEncoded() ? Base64Decoder::Decode(imgs.data) : imgs.data);
+		return 0;
 	}
 
 	LTIMING("TerminalCtrl::RenderImage");
 
 	Size fsz = GetCellSize();
 	dword id = FoldHash(CombineHash(imgs, fsz));
-	const InlineImage& imd = GetCachedImageData(id, imgs, fsz);
-	if(!IsNull(imd.image)) {
-		page->AddImage(imd.cellsize, id, scroll, encoded);
+
+	if(Size csz; IsNull(decoded) && DecodeImageAsync(id, imgs, fsz, csz)) {
+		page->AddImage(csz, id, scroll, encoded);
 		RefreshDisplay();
+		return id;
 	}
+
+	InlineImage imd = GetCachedImageData(id, imgs, fsz, decoded);
+	if(IsNull(imd.image))
+		return 0;
+
+	page->AddImage(imd.cellsize, id, scroll, encoded);
+	RefreshDisplay();
+	return id;
+}
+
+void TerminalCtrl::RefreshImage(dword id)
+{
+	// Refreshes the visible cells of the given image only.
+
+	Size csz = GetCellSize();
+	int pos = GetSbPos();
+	Rect r = Null;
+
+	auto range = GetPageRange();
+	for(int i = range.a; i < range.b; i++) {
+		const VTLine& line = page->FetchLine(i);
+		if(line.IsVoid() || !line.HasImages())
+			continue;
+		for(int j = 0; j < line.GetCount(); j++)
+			if(line[j].IsImage() && line[j].chr == id)
+				r.Union(RectC(j * csz.cx, (i - pos) * csz.cy, csz.cx, csz.cy));
+	}
+
+	if(!IsNull(r))
+		Refresh(r);
 }
 
 // Shared image data cache support.
 
-static StaticMutex sImageCacheLock;
-static LRUCache<TerminalCtrl::InlineImage> sInlineImagesCache;
+// The image cache is split into shards, selected by image id, so that the terminals and the
+// decoder threads contend only for the same shard. Each entry is accounted to the terminal
+// that created it, and each terminal has its own byte budget. This way a terminal flooding
+// the cache with images can only evict its own images. The materialized images are then kept
+// in the terminals' own image stores, for as long as their cells refer to them.
+
+struct sImageCacheEntry : Moveable<sImageCacheEntry> {
+	TerminalCtrl::InlineImage data;
+	int     owner   = 0;
+	int     size    = 0;
+	int64   tick    = 0;
+	bool    pending = false; // Being decoded by a worker thread.
+};
+
+struct sImageCacheShard {
+	Mutex   lock;
+	int64   size = 0;
+	VectorMap<dword, sImageCacheEntry> entries;
+};
+
+static const int sImageCacheShardCount = 8;
 static int sCachedImageMaxSize =  1024 * 1024 * 4 * 128;
 static int sCachedImageMaxCount =  256000;
 
-String TerminalCtrl::InlineImageMaker::Key() const
+static Atomic sImageCacheTick;
+static Atomic sImageOwners;
+static StaticMutex sImageOwnerLock;
+static VectorMap<int, int64> sImageOwnerBytes;
+
+static Atomic sImageDecoders;
+static const int sAsyncImageMinSize = 64 * 1024;
+
+static sImageCacheShard *sGetImageCacheShards()
 {
-	StringBuffer h;
-	RawCat(h, id);
-	return String(h); // Make MSVC happy...
+	static sImageCacheShard shards[sImageCacheShardCount];
+	return shards;
 }
 
-int TerminalCtrl::InlineImageMaker::Make(InlineImage& imagedata) const
+static sImageCacheShard& sGetImageCacheShard(dword id)
 {
-	LTIMING("TerminalCtrl::ImageDataMaker::Make");
+	return sGetImageCacheShards()[(id ^ (id >> 16)) % sImageCacheShardCount];
+}
 
-	auto ToCellSize = [this](Size sz) -> Size
-	{
-		Size fs(fontsize);
+static void sAccountImage(int owner, int64 size)
+{
+	// Released owners (and the unowned entries) are not accounted.
+	Mutex::Lock __(sImageOwnerLock);
+	if(int i = sImageOwnerBytes.Find(owner); i >= 0)
+		sImageOwnerBytes[i] += size;
+}
+
+static void sAddImageOwner(int owner)
+{
+	Mutex::Lock __(sImageOwnerLock);
+	sImageOwnerBytes.GetAdd(owner, 0);
+}
+
+static bool sIsImageOwner(int owner)
+{
+	Mutex::Lock __(sImageOwnerLock);
+	return sImageOwnerBytes.Find(owner) >= 0;
+}
 
-		sz.cx = (sz.cx + fs.cx - 1) / fs.cx;
-		sz.cy = (sz.cy + fs.cy - 1) / fs.cy;
+static int64 sGetImageOwnerBytes(int owner)
+{
+	Mutex::Lock __(sImageOwnerLock);
+	return sImageOwnerBytes.Get(owner, 0);
+}
+
+static void sRemoveImage(sImageCacheShard& shard, int i)
+{
+	// Shard must be locked.
+	const sImageCacheEntry& e = shard.entries[i];
+	shard.size -= e.size;
+	sAccountImage(e.owner, -e.size);
+	shard.entries.Remove(i);
+}
+
+static void sShrinkImageShard(sImageCacheShard& shard, dword keep)
+{
+	// Shard must be locked. Drops the least recently used entries, in a single sorted pass.
+	// The newest entry (keep) is never dropped, so an image larger than the shard's share of
+	// the cache still fits.
+	int64 maxsize  = max(1, sCachedImageMaxSize  / sImageCacheShardCount);
+	int   maxcount = max(1, sCachedImageMaxCount / sImageCacheShardCount);
+	int   count    = shard.entries.GetCount();
+	if(shard.size <= maxsize && count <= maxcount)
+		return;
 
-		return Size(max(1, sz.cx), max(1, sz.cy));
+	Vector<int> candidates;
+	for(int i = 0; i < shard.entries.GetCount(); i++)
+		if(!shard.entries[i].pending && shard.entries.GetKey(i) != keep)
+			candidates.Add(i);
+
+	Sort(candidates, [&](int a, int b) { return shard.entries[a].tick < shard.entries[b].tick; });
+
+	for(int i : candidates) {
+		if(shard.size <= maxsize && count <= maxcount)
+			break;
+		const sImageCacheEntry& e = shard.entries[i];
+		shard.size -= e.size;
+		sAccountImage(e.owner, -e.size);
+		shard.entries.Unlink(i);
+		count--;
+	}
+	shard.entries.Sweep();
+}
+
+static void sShrinkImageOwner(int owner, int64 budget)
+{
+	// Drops the least recently used images of a terminal that exceeds its budget. The
+	// candidates are collected in a single pass over the shards, and evicted as a batch.
+	int64 excess = sGetImageOwnerBytes(owner) - budget;
+	if(excess <= 0)
+		return;
+
+	struct Candidate : Moveable<Candidate> {
+		int   shard;
+		dword id;
+		int64 tick;
 	};
 
-	auto AdjustSize = [this](Size sr, Size sz) -> Size
+	Vector<Candidate> candidates;
+	for(int i = 0; i < sImageCacheShardCount; i++) {
+		sImageCacheShard& shard = sGetImageCacheShards()[i];
+		Mutex::Lock __(shard.lock);
+		for(int j = 0; j < shard.entries.GetCount(); j++) {
+			const sImageCacheEntry& e = shard.entries[j];
+			if(e.owner == owner && !e.pending)
+				candidates.Add({ i, shard.entries.GetKey(j), e.tick });
+		}
+	}
+
+	Sort(candidates, [](const Candidate& a, const Candidate& b) { return a.tick < b.tick; });
+
+	for(const Candidate& q : candidates) {
+		if(excess <= 0)
+			break;
+		sImageCacheShard& shard = sGetImageCacheShards()[q.shard];
+		Mutex::Lock __(shard.lock);
+		if(int i = shard.entries.Find(q.id); i >= 0 && shard.entries[i].owner == owner && !shard.entries[i].pending) {
+			excess -= shard.entries[i].size;
+			sRemoveImage(shard, i);
+		}
+	}
+}
+
+static bool sFindImage(dword id, TerminalCtrl::InlineImage& data, bool& pending)
+{
+	sImageCacheShard& shard = sGetImageCacheShard(id);
+	Mutex::Lock __(shard.lock);
+	int i = shard.entries.Find(id);
+	if(i < 0)
+		return false;
+	sImageCacheEntry& e = shard.entries[i];
+	e.tick  = ++sImageCacheTick;
+	data    = e.data;
+	pending = e.pending;
+	return true;
+}
+
+static bool sAddImage(int owner, int64 budget, dword id, const TerminalCtrl::InlineImage& data, int size, bool pending,
+						TerminalCtrl::InlineImage *existing = nullptr)
+{
+	// Returns false if the image is already cached (or being decoded).
 	{
-		if(imgs.IsKeepRatio()) {
-			if(sr.cx == 0 && sr.cy > 0)
-				sr.cx = max(1, sr.cy * sz.cx / sz.cy);
-			else
-			if(sr.cy == 0 && sr.cx > 0)
-				sr.cy = max(1, sr.cx * sz.cy / sz.cx);
+		sImageCacheShard& shard = sGetImageCacheShard(id);
+		Mutex::Lock __(shard.lock);
+		if(int i = shard.entries.Find(id); i >= 0) {
+			if(existing)
+				*existing = shard.entries[i].data;
+			return false;
 		}
-		else {
-			if(sr.cx <= 0)
-				sr.cx = sz.cx;
-			if(sr.cy <= 0)
-				sr.cy = sz.cy;
+		sImageCacheEntry& e = shard.entries.Add(id);
+		e.data    = data;
+		e.owner   = owner;
+		e.size    = size;
+		e.tick    = ++sImageCacheTick;
+		e.pending = pending;
+		shard.size += size;
+		sAccountImage(owner, size);
+		sShrinkImageShard(shard, id);
+	}
+	sShrinkImageOwner(owner, budget);
+	return true;
+}
+
+static void sSetImage(int owner, int64 budget, dword id, const TerminalCtrl::InlineImage& data, int size)
+{
+	// Completes a pending image, or re-adds it if it was evicted meanwhile.
+	{
+		sImageCacheShard& shard = sGetImageCacheShard(id);
+		Mutex::Lock __(shard.lock);
+		int i = shard.entries.Find(id);
+		if(i < 0) {
+			if(!sIsImageOwner(owner)) // The terminal is gone.
+				return;
+			i = shard.entries.GetCount();
+			sImageCacheEntry& e = shard.entries.Add(id);
+			e.owner = owner;
 		}
+		sImageCacheEntry& e = shard.entries[i];
+		shard.size += size - e.size;
+		sAccountImage(e.owner, size - e.size);
+		e.data    = data;
+		e.size    = size;
+		e.tick    = ++sImageCacheTick;
+		e.pending = false;
+		sShrinkImageShard(shard, id);
+	}
+	sShrinkImageOwner(owner, budget);
+}
 
-		return sr != sz ? sr : Null;
-	};
+String TerminalCtrl::InlineImageMaker::Key() const
+{
+	StringBuffer h;
+	RawCat(h, id);
+	return String(h); // Make MSVC happy...
+}
+
+Size TerminalCtrl::InlineImageMaker::ToCellSize(Size sz) const
+{
+	Size fs(fontsize);
+
+	sz.cx = (sz.cx + fs.cx - 1) / fs.cx;
+	sz.cy = (sz.cy + fs.cy - 1) / fs.cy;
+
+	return Size(max(1, sz.cx), max(1, sz.cy));
+}
+
+Size TerminalCtrl::InlineImageMaker::AdjustSize(Size sr, Size sz) const
+{
+	if(imgs.IsKeepRatio()) {
+		if(sr.cx == 0 && sr.cy > 0)
+			sr.cx = max(1, sr.cy * sz.cx / sz.cy);
+		else
+		if(sr.cy == 0 && sr.cx > 0)
+			sr.cy = max(1, sr.cx * sz.cy / sz.cx);
+	}
+	else {
+		if(sr.cx <= 0)
+			sr.cx = sz.cx;
+		if(sr.cy <= 0)
+			sr.cy = sz.cy;
+	}
+
+	return sr != sz ? sr : Null;
+}
+
+int TerminalCtrl::InlineImageMaker::Make(InlineImage& imagedata) const
+{
+	LTIMING("TerminalCtrl::ImageDataMaker::Make");
 
 	auto RawToImage = [](const String& raw, Size sz, bool rgba) -> Image
 	{
@@ -523,16 +1016,26 @@ int TerminalCtrl::InlineImageMaker::Make(InlineImage& imagedata) const
 
 	Image img;
 
+	auto Decode = [this]() -> String
+	{
+		String s = imgs.IsEncoded() ? Base64Decoder::Decode(imgs.data) : imgs.data;
+		return imgs.IsCompressed() ? ZDecompress(s) : s;
+	};
+
+	if(!IsNull(decoded)) {
+		img = decoded;
+	}
+	else
 	if(imgs.IsSixel()) { // Never base64 encoded
 		img = (Image) SixelStream(imgs.data, imgs.palette).Background(!imgs.IsTransparent());
 	}
 	else
-	if(imgs.IsRaster()) { // Always base64 encoded (PNG, JPG, TIFF, etc.)
-		img = StreamRaster::LoadStringAny(imgs.IsCompressed() ? ZDecompress(Base64Decode(imgs.data)) : Base64Decode(imgs.data));
+	if(imgs.IsRaster()) { // Base64 encoded (PNG, JPG, TIFF, etc.), unless predecoded.
+		img = StreamRaster::LoadStringAny(Decode());
 	}
 	else
-	if(imgs.IsRaw()) { // Always base64 encoded (RGB or RGBA raw data)
-		img = RawToImage(imgs.IsCompressed() ? ZDecompress(Base64Decode(imgs.data)) : Base64Decode(imgs.data), imgs.size, imgs.IsRGBA());
+	if(imgs.IsRaw()) { // Base64 encoded (RGB or RGBA raw data), unless predecoded.
+		img = RawToImage(Decode(), imgs.size, imgs.IsRGBA());
 	}
 
 	if(IsNull(img))
@@ -551,60 +1054,395 @@ int TerminalCtrl::InlineImageMaker::Make(InlineImage& imagedata) const
 	return imagedata.image.GetLength() * 4;
 }
 
-const TerminalCtrl::InlineImage& TerminalCtrl::GetCachedImageData(dword id, const ImageString& imgs, const Size& csz)
+TerminalCtrl::InlineImage TerminalCtrl::GetCachedImageData(dword id, const ImageString& imgs, const Size& csz, const Image& decoded)
 {
-	Mutex::Lock __(sImageCacheLock);
-
 	LTIMING("TerminalCtrl::GetCachedImageData");
 
-	InlineImageMaker im(id, imgs, csz);
-	sInlineImagesCache.Shrink(sCachedImageMaxSize, sCachedImageMaxCount);
-	return sInlineImagesCache.Get(im);
+	// Materialized images are read from the image store without locking.
+	if(int i = imagestore.Find(id); i >= 0) {
+		StoredImage& e = imagestore[i];
+		e.tick = ++imagestoretick;
+		return e.data;
+	}
+
+	InlineImage imd;
+	bool pending = false;
+
+	if(!sFindImage(id, imd, pending)) {
+		if(IsNull(imgs) && IsNull(decoded))
+			return imd;
+		InlineImageMaker m(id, imgs, csz);
+		m.decoded = decoded;
+		int size = m.Make(imd); // Decode without locking.
+		if(!size)
+			return InlineImage();
+		sAddImage(GetImageCacheOwner(), imagebudget, id, imd, size, false, &imd);
+	}
+
+	if(!pending && !IsNull(imd.image))
+		StoreImage(id, imd);
+
+	return imd;
+}
+
+void TerminalCtrl::StoreImage(dword id, const InlineImage& imd)
+{
+	StoredImage& e = imagestore.GetAdd(id);
+	imagestorebytes += (int64) imd.image.GetLength() * 4 - e.size;
+	e.data = imd;
+	e.size = (int64) imd.image.GetLength() * 4;
+	e.tick = ++imagestoretick;
+	if(imagestore.GetCount() >= imagestoresweep || imagestorebytes > imagestorebudget)
+		SweepImages(id); // The image can be stored before its cells are added.
+}
+
+void TerminalCtrl::ReleaseDroppedImages()
+{
+	// Releases the stored images as soon as the lines that referred to them are erased, or
+	// dropped from the history buffer. This is deferred until the page operations complete.
+
+	if(!dpage.HasDroppedImages() && !apage.HasDroppedImages())
+		return;
+
+	dpage.ClearDroppedImages();
+	apage.ClearDroppedImages();
+	if(!imagestore.IsEmpty())
+		SweepImages();
+}
+
+void TerminalCtrl::SweepImages(dword keep)
+{
+	LTIMING("TerminalCtrl::SweepImages");
+
+	// Finds the stored images referred to by the image cells on both pages, including the
+	// history, and releases the rest. If the store still exceeds its budget, the least
+	// recently used images that are not on the screen are dropped. (These can be restored
+	// only if they are still in the shared cache.)
+
+	Vector<bool> referenced, pinned;
+	referenced.SetCount(imagestore.GetCount(), false);
+	pinned.SetCount(imagestore.GetCount(), false);
+
+	auto Ref = [&](const VTLine& line, Vector<bool>& flags) {
+		dword lastid = 0;
+		int   q = -1;
+		for(const VTCell& cell : line) {
+			if(!cell.IsImage())
+				continue;
+			if(cell.chr != lastid || q < 0) {
+				lastid = cell.chr;
+				q = imagestore.Find(lastid);
+			}
+			if(q >= 0)
+				flags[q] = true;
+		}
+	};
+
+	for(const VTPage *p : { &dpage, &apage })
+		for(int i = 0; i < p->GetLineCount(); i++)
+			if(const VTLine& line = p->FetchLine(i); line.HasImages())
+				Ref(line, referenced);
+
+	auto range = GetPageRange();
+	for(int i = range.a; i < range.b; i++)
+		if(const VTLine& line = page->FetchLine(i); line.HasImages())
+			Ref(line, pinned);
+
+	if(int q = imagestore.Find(keep); q >= 0)
+		referenced[q] = pinned[q] = true;
+
+	for(int i = 0; i < referenced.GetCount(); i++)
+		if(!referenced[i]) {
+			imagestorebytes -= imagestore[i].size;
+			imagestore.Unlink(i);
+		}
+
+	if(imagestorebytes > imagestorebudget) {
+		Vector<int> candidates;
+		for(int i = 0; i < imagestore.GetCount(); i++)
+			if(!imagestore.IsUnlinked(i) && !pinned[i])
+				candidates.Add(i);
+		Sort(candidates, [&](int a, int b) { return imagestore[a].tick < imagestore[b].tick; });
+		for(int q : candidates) {
+			if(imagestorebytes <= imagestorebudget)
+				break;
+			imagestorebytes -= imagestore[q].size;
+			imagestore.Unlink(q);
+		}
+	}
+
+	imagestore.Sweep();
+	imagestoresweep = max(2 * imagestore.GetCount(), 64);
+	LLOG("SweepImages() -> count: " << imagestore.GetCount() << ", bytes: " << imagestorebytes);
+}
+
+void TerminalCtrl::SerializeImages(Stream& s)
+{
+	// Session snapshots carry the materialized images referred to by the image cells,
+	// so that the restored session doesn't need to redecode them.
+
+	Vector<dword> ids;
+	Vector<InlineImage> images;
+
+	if(s.IsStoring()) {
+		Index<dword> refs;
+		for(const VTPage *p : { &dpage, &apage })
+			for(int i = 0; i < p->GetLineCount(); i++)
+				if(const VTLine& line = p->FetchLine(i); line.HasImages())
+					for(const VTCell& cell : line)
+						if(cell.IsImage())
+							refs.FindAdd(cell.chr);
+		for(dword id : refs) {
+			InlineImage imd;
+			bool pending = false;
+			if(int q = imagestore.Find(id); q >= 0)
+				imd = imagestore[q].data;
+			else
+			if(!sFindImage(id, imd, pending) || pending || IsNull(imd.image))
+				continue; // Lost, or not decoded yet.
+			ids.Add(id);
+			images.Add(imd);
+		}
+	}
+
+	int count = ids.GetCount();
+	s / count;
+	if(s.IsLoading() && count < 0) {
+		s.LoadError();
+		return;
+	}
+
+	// The count read from the stream is not trusted: The entries are added one by one.
+	for(int i = 0; i < count && !s.IsError(); i++) {
+		if(s.IsLoading()) {
+			if(s.IsEof()) {
+				s.LoadError();
+				return;
+			}
+			ids.Add();
+			images.Add();
+		}
+		InlineImage& imd = images[i];
+		s % ids[i];
+		s % imd.image;
+		s % imd.cellsize;
+		s % imd.fontsize;
+		s % imd.paintrect;
+	}
+
+	if(s.IsLoading() && !s.IsError()) {
+		imagestore.Clear();
+		imagestorebytes = 0;
+		imagestoresweep = max(2 * ids.GetCount(), 64);
+		for(int i = 0; i < ids.GetCount(); i++) {
+			StoredImage& e = imagestore.GetAdd(ids[i]);
+			imagestorebytes -= e.size;
+			e.data = pick(images[i]);
+			e.size = (int64) e.data.image.GetLength() * 4;
+			e.tick = ++imagestoretick;
+			imagestorebytes += e.size;
+		}
+	}
+}
+
+static String sGetImageHeader(const ImageString& imgs)
+{
+	// Returns the leading part of the decoded image data, which is usually enough to read
+	// the image size. The whole image is decoded later, by the worker thread.
+
+	const int probesize = 64 * 1024;
+
+	String s = imgs.IsEncoded()
+		? Base64Decoder::Decode(~imgs.data, min(imgs.data.GetLength(), probesize))
+		: imgs.data.Left(probesize);
+	if(imgs.IsCompressed()) {
+		Zlib zlib;
+		zlib.Decompress();
+		zlib.Put(s);
+		s = zlib.Get();
+	}
+	return s;
+}
+
+bool TerminalCtrl::DecodeImageAsync(dword id, const ImageString& imgs, const Size& csz, Size& cellsize)
+{
+	// Large images are decoded and rescaled by the worker threads, provided that their final
+	// size can be determined beforehand. Their cells show a placeholder until they are ready.
+
+	if(imgs.data.GetLength() < sAsyncImageMinSize || sImageDecoders >= CPU_Cores())
+		return false;
+
+	LTIMING("TerminalCtrl::DecodeImageAsync");
+
+	ImageString job = imgs;
+	Size isz = Null;
+
+	if(imgs.IsSixel()) {
+		if(imgs.palette) // Shared sixel palettes need to be updated in order.
+			return false;
+		isz = SixelStream::GetRasterSize(imgs.data);
+	}
+	else
+	if(imgs.IsRaster()) {
+		StringStream ss(sGetImageHeader(imgs));
+		One<StreamRaster> r = StreamRaster::OpenAny(ss);
+		if(!r.IsEmpty())
+			isz = r->GetSize();
+	}
+	else
+		isz = imgs.size;
+
+	if(IsNull(isz) || isz.cx <= 0 || isz.cy <= 0)
+		return false;
+
+	InlineImageMaker m(id, job, csz);
+	Size sz = IsNull(job.size) ? isz : Nvl(m.AdjustSize(job.size, isz), isz);
+
+	InlineImage imd;
+	imd.fontsize = csz;
+	imd.cellsize = m.ToCellSize(sz);
+	cellsize = imd.cellsize;
+
+	int   owner  = GetImageCacheOwner();
+	int64 budget = imagebudget;
+
+	if(!sAddImage(owner, budget, id, imd, max(1, sz.cx * sz.cy * 4), true, &imd)) {
+		cellsize = imd.cellsize; // Already decoded or being decoded.
+		return true;
+	}
+
+	Event<> done = [=, p = Ptr<Ctrl>(this)] { if(p) RefreshImage(id); };
+
+	sImageDecoders++;
+	CoWork::Schedule([=, job = pick(job), done = pick(done)]() mutable {
+		InlineImage imd;
+		Size fsz = csz;
+		int size = InlineImageMaker(id, job, fsz).Make(imd);
+		sSetImage(owner, budget, id, imd, size);
+		sImageDecoders--;
+		PostCallback(pick(done));
+	});
+
+	return true;
+}
+
+bool TerminalCtrl::IsImagePending(dword id)
+{
+	InlineImage imd;
+	bool pending = false;
+	return sFindImage(id, imd, pending) && pending;
+}
+
+int TerminalCtrl::GetImageCacheOwner()
+{
+	if(!imageowner) {
+		imageowner = ++sImageOwners;
+		sAddImageOwner(imageowner);
+	}
+	return imageowner;
+}
+
+void TerminalCtrl::ReleaseImageCacheOwner()
+{
+	// The cached images of a destroyed terminal stay in the shared cache, unowned.
+
+	if(!imageowner)
+		return;
+
+	for(int i = 0; i < sImageCacheShardCount; i++) {
+		sImageCacheShard& shard = sGetImageCacheShards()[i];
+		Mutex::Lock __(shard.lock);
+		for(sImageCacheEntry& e : shard.entries)
+			if(e.owner == imageowner)
+				e.owner = 0;
+	}
+
+	Mutex::Lock __(sImageOwnerLock);
+	sImageOwnerBytes.RemoveKey(imageowner);
+	imageowner = 0;
+}
+
+int64 TerminalCtrl::GetImageCacheUsage() const
+{
+	return imageowner ? sGetImageOwnerBytes(imageowner) : 0;
 }
 
 void TerminalCtrl::ClearImageCache()
 {
-	Mutex::Lock __(sImageCacheLock);
-	sInlineImagesCache.Clear();
+	for(int i = 0; i < sImageCacheShardCount; i++) {
+		sImageCacheShard& shard = sGetImageCacheShards()[i];
+		Mutex::Lock __(shard.lock);
+		while(shard.entries.GetCount())
+			sRemoveImage(shard, shard.entries.GetCount() - 1);
+	}
 }
 
 void TerminalCtrl::SetImageCacheMaxSize(int maxsize, int maxcount)
 {
-	Mutex::Lock __(sImageCacheLock);
 	sCachedImageMaxSize  = max(1, maxsize);
 	sCachedImageMaxCount = max(1, maxcount);
 }
 
+// Hypertext table support.
+
 dword TerminalCtrl::RenderHypertext(const String& uri)
 {
-	dword h = FoldHash(GetHashValue(uri));
-	GetCachedHypertext(h, uri);
-	return h;
+	int i = hypertexts.Find(uri);
+	if(i < 0) {
+		if(hypertextcount >= hypertextsweep)
+			SweepHypertexts();
+		i = hypertexts.Put(uri); // Reuses an unlinked slot, if any.
+		hypertextcount++;
+	}
+	return i + 1;
 }
 
-// Shared hypertext cache support.
-
-String TerminalCtrl::HypertextMaker::Key() const
+String TerminalCtrl::GetHypertext(dword id) const
 {
-	StringBuffer h;
-	RawCat(h, id);
-	return String(h); // Make MSVC happy...
+	int i = (int) id - 1;
+	return i >= 0 && i < hypertexts.GetCount() && !hypertexts.IsUnlinked(i) ? hypertexts[i] : String();
 }
 
-int TerminalCtrl::HypertextMaker::Make(Value& obj) const
+void TerminalCtrl::SweepHypertexts()
 {
-	LTIMING("TerminalCtrl::HypertextMaker::Make");
+	LTIMING("TerminalCtrl::SweepHypertexts");
 
-	obj = txt;
-	return txt.GetLength();
-}
+	// Counts the references to each entry and releases the ones that are no longer
+	// referenced by any cell on either page, including the history. Their slots are
+	// then reused. The table is swept when its live entries reach twice their count
+	// after the last sweep.
 
-String TerminalCtrl::GetCachedHypertext(dword id, const String& data)
-{
-	LTIMING("TerminalCtrl::GetCachedHypertext");
+	Vector<int> refs;
+	refs.SetCount(hypertexts.GetCount(), 0);
+
+	auto Ref = [&](const VTCell& cell) {
+		if(cell.IsHypertext() && cell.data > 0 && cell.data <= (dword) refs.GetCount())
+			refs[cell.data - 1]++;
+	};
+
+	for(const VTPage *p : { &dpage, &apage })
+		for(int i = 0; i < p->GetLineCount(); i++)
+			if(const VTLine& line = p->FetchLine(i); line.HasHypertext())
+				for(const VTCell& cell : line)
+					Ref(cell);
+
+	Ref(cellattrs);
+	Ref(cellattrs_backup);
+	Ref(dpage.GetAttributes());
+	Ref(apage.GetAttributes());
+
+	int live = 0;
+	for(int i = 0; i < refs.GetCount(); i++) {
+		if(refs[i])
+			live++;
+		else
+		if(!hypertexts.IsUnlinked(i))
+			hypertexts.Unlink(i);
+	}
 
-	HypertextMaker m(id, data);
-	return MakeValue(m);
+	hypertextcount = live;
+	hypertextsweep = max(2 * live, 1024);
+	LLOG("SweepHypertexts() -> live: " << live << ", table: " << hypertexts.GetCount());
 }
 
 void TerminalCtrl::ClearHyperlinkCache()
@@ -642,9 +1480,11 @@ public:
 	{
 		const auto& im = q.To<TerminalCtrl::InlineImage>();
 		if(!IsNull(im.image)) {
-			Size csz = im.cellsize;
-			Size fsz = im.fontsize;
-			w.DrawImage(r, CachedRescale(im.image, csz * fsz), im.paintrect);
+			Size sz = im.cellsize * im.fontsize;
+			if(im.image.GetSize() == sz) // Prescaled by the terminal.
+				w.DrawImage(r, im.image, im.paintrect);
+			else
+				w.DrawImage(r, CachedRescale(im.image, sz), im.paintrect);
 		}
 	}
 	virtual Size GetStdSize(const Value& q) const
@@ -0,0 +1,36 @@
+#ifndef _Terminal_Simd_h_
+#define _Terminal_Simd_h_
+
+#include <Core/Core.h>
+
+namespace Upp {
+
+// Internal SIMD helpers, shared by the sixel and base64 decoders.
+
+#ifdef CPU_SIMD
+namespace TerminalSimd {
+#ifdef CPU_SSE2
+force_inline
+int MoveMask(i8x16 v)
+{
+	return _mm_movemask_epi8(v.data);
+}
+#elif CPU_NEON
+force_inline
+int MoveMask(i8x16 v)
+{
+	constexpr uint8x16_t bitmask = {
+		0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
+		0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80
+	};
+	uint8x16_t masked = vandq_u8(vreinterpretq_u8_s8(v.data), bitmask);
+	uint8x8_t sum = vpadd_u8(vget_low_u8(masked), vget_high_u8(masked));
+	sum           = vpadd_u8(sum, sum);
+	sum           = vpadd_u8(sum, sum);
+	return vget_lane_u16(vreinterpret_u16_u8(sum), 0);
+}
+#endif
+}
+#endif
+}
+#endif
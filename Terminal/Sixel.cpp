@@ -1,36 +1,11 @@
 #include "Sixel.h"
+#include "Simd.h"
 
 #define LLOG(x)		 // RLOG("SixelStream: " << x)
 #define LTIMING(x)	 // RTIMING(x)
 
 namespace Upp {
 
-#ifdef CPU_SIMD
-namespace SimdSixel {
-#ifdef CPU_SSE2
-static force_inline
-int MoveMask(i8x16 v)
-{
-	return _mm_movemask_epi8(v.data);
-}
-#elif CPU_NEON
-static force_inline
-int MoveMask(i8x16 v)
-{
-	constexpr uint8x16_t bitmask = {
-		0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
-		0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80
-	};
-	uint8x16_t masked = vandq_u8(vreinterpretq_u8_s8(v.data), bitmask);
-	uint8x8_t sum = vpadd_u8(vget_low_u8(masked), vget_high_u8(masked));
-	sum           = vpadd_u8(sum, sum);
-	sum           = vpadd_u8(sum, sum);
-	return vget_lane_u16(vreinterpret_u16_u8(sum), 0);
-}
-#endif
-}
-#endif
-
 void SixelStream::Palette::Init()
 {
 	SetCount(256, RGBAZero());
@@ -58,6 +33,9 @@ SixelStream::SixelStream(const void *data, int64 size, Palette *shared_palette)
 : MemReadStream(data, size)
 , paletteptr(shared_palette)
 , background(true)
+, started(false)
+, done(false)
+, deferred(false)
 {
 }
 
@@ -65,10 +43,53 @@ SixelStream::SixelStream(const String& data, Palette *shared_palette)
 : MemReadStream(~data, data.GetLength())
 , paletteptr(shared_palette)
 , background(true)
+, started(false)
+, done(false)
+, deferred(false)
+{
+}
+
+SixelStream::SixelStream(Palette *shared_palette)
+: paletteptr(shared_palette)
+, background(true)
+, started(false)
+, done(false)
+, deferred(false)
+{
+}
+
+static Size sGetRasterSize(const byte *s, const byte *e)
+{
+	// Returns the image size declared by the raster attributes ("Pan;Pad;Ph;Pv), if any.
+
+	while(s < e && *s <= 0x20)
+		s++;
+	if(s >= e || *s++ != 0x22)
+		return Null;
+
+	int params[4] = { 0 }, i = 0;
+	for(; s < e && i < 4; s++) {
+		if(*s > 0x2F && *s < 0x3A)
+			params[i] = min(params[i] * 10 + (*s - 0x30), 65536);
+		else
+		if(*s == ';')
+			i++;
+		else
+			break;
+	}
+
+	Size sz(params[2], params[3]);
+	if(sz.cx <= 0 || sz.cy <= 0 || sz.cx > 4096 || sz.cy > 4096)
+		return Null;
+	return sz;
+}
+
+Size SixelStream::GetRasterSize(const String& data)
 {
+	return sGetRasterSize((const byte*) data.Begin(), (const byte*) data.End());
 }
 
-void SixelStream::Clear()
+void SixelStream::Clear(Size canvas)
 {
 	if(!paletteptr)
 		paletteptr = &private_palette;
@@ -87,7 +108,17 @@ void SixelStream::Clear()
 
 	Zero(params);
 
-	buffer.Create(1024, 1024);
+	// Allocate the canvas at once if the raster attributes declare its size. Otherwise
+	// start small and let AdjustBufferSize() grow it. The extra rows are for the
+	// first (unused) row and the last sixel band.
+	raster = sGetRasterSize(ptr, rdlim);
+	if(!IsNull(canvas))
+		buffer.Create(canvas);
+	else
+	if(!IsNull(raster))
+		buffer.Create(raster.cx, raster.cy + 7);
+	else
+		buffer.Create(256, 256);
 	Fill(buffer, buffer.GetSize(), paper);
 
 	CalcYOffests();
@@ -167,8 +198,9 @@ static Color sHSLColor(int h, int s, int l)
 }
 
 force_inline
-void SixelStream::SetPalette()
+bool SixelStream::SetPalette()
 {
+	// Returns true if a color register is (re)defined.
 	LTIMING("SixelStream::SetPalette");
 
 	int n = ReadParams();
@@ -192,12 +224,13 @@ void SixelStream::SetPalette()
 		default:
 			break;
 		}
+		return true;
 	}
-	else
 	if(n == 1) {
 		ink = paletteptr->At(params[0]);
 		ink.a = 0xFF;
 	}
+	return false;
 }
 
 force_inline
@@ -221,8 +254,18 @@ void SixelStream::AdjustBufferSize()
 	LTIMING("AdjustBufferSize");
 	if((cursor.x + repeat >= 4096) || (cursor.y + 6 >= 4096))
 		throw Exc("Sixel canvas size is too big > (4096 x 4096)");
-	ImageBuffer ibb(buffer.GetSize() += 512);
-	Copy(ibb, Point(0, 0), buffer, buffer.GetSize());
+
+	// Grow geometrically, and only in the required direction(s).
+	Size sz = buffer.GetSize();
+	Size nsz = sz;
+	if(sz.cx < cursor.x + max(repeat, 1))
+		nsz.cx = min(max(cursor.x + max(repeat, 1), sz.cx * 2), 4096);
+	if(sz.cy < cursor.y + 6)
+		nsz.cy = min(max(cursor.y + 6, sz.cy * 2), 4096);
+
+	ImageBuffer ibb(nsz);
+	Fill(ibb, ibb.GetSize(), paper);
+	Copy(ibb, Point(0, 0), buffer, sz);
 	buffer = ibb;
 	CalcYOffests();
 }
@@ -232,7 +275,7 @@ void SixelStream::PaintSixel(int c)
 	LTIMING("SixelStream::PaintSixel");
 
 	Size sz = buffer.GetSize();
-	if((sz.cx < cursor.x + repeat) || (sz.cy < cursor.y))
+	if((sz.cx < cursor.x + max(repeat, 1)) || (sz.cy < cursor.y + 6))
 		AdjustBufferSize();
 
 	if(!repeat) {
@@ -252,11 +295,9 @@ void SixelStream::PaintSixel(int c)
 	}
 }
 
-SixelStream::operator Image()
+void SixelStream::Run()
 {
-	Clear();
-
-	LTIMING("SixelStream::Get");
+	LTIMING("SixelStream::Run");
 
 	try {
 		for(;;) {
@@ -269,10 +310,10 @@ SixelStream::operator Image()
 				i8x16 c2(ptr + 32), m2 = ((c2 & del) < lo) | (c2 == del);
 				i8x16 c3(ptr + 48), m3 = ((c3 & del) < lo) | (c3 == del);
 				if(AnyTrue(m0 | m1 | m2 | m3)) {
-					uint64 mask = (uint64)(uint16) SimdSixel::MoveMask(m0)
-								| ((uint64)(uint16) SimdSixel::MoveMask(m1) << 16)
-								| ((uint64)(uint16) SimdSixel::MoveMask(m2) << 32)
-								| ((uint64)(uint16) SimdSixel::MoveMask(m3) << 48);
+					uint64 mask = (uint64)(uint16) TerminalSimd::MoveMask(m0)
+								| ((uint64)(uint16) TerminalSimd::MoveMask(m1) << 16)
+								| ((uint64)(uint16) TerminalSimd::MoveMask(m2) << 32)
+								| ((uint64)(uint16) TerminalSimd::MoveMask(m3) << 48);
 					for(int i = 0, n = CountTrailingZeroBits64(mask); i < n; i++)
 						PaintSixel(*ptr++ - 0x03F);
 					goto SCALAR_FALLBACK;
@@ -283,7 +324,7 @@ SixelStream::operator Image()
 			}
 			while(ptr + 16 <= rdlim && !repeat) {
 	            i8x16 chunk(ptr);
-	            if(int mask = SimdSixel::MoveMask(((chunk & del) < lo) | (chunk == del)); mask != 0) {
+	            if(int mask = TerminalSimd::MoveMask(((chunk & del) < lo) | (chunk == del)); mask != 0) {
                     for(int i = 0, n = CountTrailingZeroBits(mask); i < n; i++)
 	                    PaintSixel(*ptr++ - 0x3F);
 	                goto SCALAR_FALLBACK;
@@ -318,7 +359,8 @@ SCALAR_FALLBACK:
 			case 0x1A:
 			case 0x1B:
 			case 0x1C:
-				goto Finalize;
+				done = true;
+				return;
 			case 0x7F:
 				break;
 			default:
@@ -330,10 +372,225 @@ SCALAR_FALLBACK:
 	}
 	catch(const Exc& e) {
 		LLOG(e);
+		done = true;
+	}
+}
+
+Image SixelStream::GetCanvas()
+{
+	// The last band can overshoot the declared raster height by up to five rows.
+	int cy = max(size.cy, 6);
+	if(!IsNull(raster) && cy > raster.cy && cy - raster.cy < 6)
+		cy = raster.cy;
+	return Crop(buffer, 0, 1, size.cx, cy);
+}
+
+bool SixelStream::RunParallel()
+{
+	// Large images are rasterized band by band, in parallel. A serial pre-scan finds
+	// the band boundaries, the canvas width, and the color state at each band start.
+
+	if(rdlim - ptr < 256 * 1024 || CPU_Cores() < 2)
+		return false;
+
+	LTIMING("SixelStream::RunParallel");
+
+	struct Band : Moveable<Band> {
+		const byte *begin;
+		const byte *end;
+		int         palette;
+		RGBA        ink;
+	};
+
+	Vector<Band> bands;
+	Array<Palette> palettes;
+	bool changed = true;
+	int  width = 0, x = 0;
+
+	// The pre-scan applies the color definitions to the (possibly shared) palette.
+	Palette initial;
+	initial <<= *paletteptr;
+
+	auto Fail = [&] {
+		*paletteptr <<= initial;
+		Seek(0); // Restart with the serial decoder.
+		Clear();
+		return false;
+	};
+
+	auto AddBand = [&] {
+		if(changed) {
+			palettes.Add() <<= *paletteptr;
+			changed = false;
+		}
+		Band& b   = bands.Add();
+		b.begin   = ptr;
+		b.end     = rdlim;
+		b.palette = palettes.GetCount() - 1;
+		b.ink     = ink;
+	};
+
+	AddBand();
+
+	while(ptr < rdlim) {
+		byte c = *ptr++ & 0x7F;
+		switch(c) {
+		case 0x21:
+			GetRepeatCount();
+			break;
+		case 0x22:
+			ReadParams();
+			break;
+		case 0x23:
+			changed |= SetPalette();
+			break;
+		case 0x24:
+			x = 0;
+			break;
+		case 0x2D:
+			bands.Top().end = ptr - 1;
+			if(bands.GetCount() * 6 + 7 >= 4096) // Let the serial decoder handle the overflow.
+				return Fail();
+			x = 0;
+			AddBand();
+			break;
+		case 0x18:
+		case 0x1A:
+		case 0x1B:
+		case 0x1C:
+			bands.Top().end = ptr - 1;
+			ptr = rdlim;
+			break;
+		case 0x7F:
+			break;
+		default:
+			if(c > 0x3E) {
+				width = max(width, x += max(repeat, 1));
+				repeat = 0;
+				if(x >= 4096)
+					return Fail();
+			}
+			break;
+		}
+	}
+
+	if(bands.GetCount() < 8)
+		return Fail();
+
+	width = max(width, 1);
+	buffer.Create(width, bands.GetCount() * 6 + 1);
+	Fill(buffer, buffer.GetSize(), paper);
+
+	Vector<int> widths;
+	widths.SetCount(bands.GetCount(), 0);
+
+	CoFor(bands.GetCount(), [&](int i) {
+		const Band& b = bands[i];
+		Palette pal;
+		pal <<= palettes[b.palette];
+		SixelStream s(b.begin, b.end - b.begin, &pal);
+		s.Background(background);
+		s.Clear(Size(width, 7));
+		s.ink   = b.ink;
+		s.paper = paper; // Color register 0 may be redefined by now.
+		Fill(s.buffer, s.buffer.GetSize(), paper);
+		s.Run();
+		int cx = min(width, s.buffer.GetWidth());
+		for(int r = 0; r < 6; r++)
+			memcpy(buffer[i * 6 + r + 1], s.buffer[r + 1], cx * sizeof(RGBA));
+		widths[i] = min(width, s.size.cx);
+	});
+
+	size.cx = 0;
+	for(int cx : widths)
+		size.cx = max(size.cx, cx);
+	size.cy = (bands.GetCount() - 1) * 6 + 1;
+	return true;
+}
+
+SixelStream::operator Image()
+{
+	Clear();
+	started = true;
+	if(!RunParallel())
+		Run();
+	return GetCanvas();
+}
+
+void SixelStream::Decode(const void *data, int size)
+{
+	Create(data, size);
+	if(!started) {
+		Clear(); // Reads the raster attributes, if any, from the first chunk.
+		started = true;
+	}
+	Run();
+}
+
+void SixelStream::Put(const void *data, int size)
+{
+	// Decodes the sixel data as it arrives. The data can be split at any point: a control
+	// function whose parameters may continue in the next chunk is carried over to it.
+
+	LTIMING("SixelStream::Put");
+
+	if(done || size <= 0)
+		return;
+
+	// Large images that declare their size are collected instead, and rasterized band by
+	// band in parallel when they are complete.
+	if(!started && !deferred && carry.IsEmpty()) {
+		Size sz = sGetRasterSize((const byte*) data, (const byte*) data + size);
+		deferred = !IsNull(sz) && sz.cx * sz.cy >= 512 * 512 && CPU_Cores() > 1;
+	}
+
+	if(deferred) {
+		pending.Cat((const char*) data, size);
+		return;
 	}
 
-Finalize:
-	return Crop(buffer, 0, 1, size.cx, max(size.cy, 6));
+	auto IsParam = [](byte c) { return (c > 0x2F && c < 0x3A) || c == ';'; };
+
+	const byte *s = (const byte*) data;
+	const byte *e = s + size;
+
+	if(!carry.IsEmpty()) {
+		while(s < e && IsParam(*s))
+			carry.Cat(*s++);
+		if(s == e && carry.GetLength() < 256) // Still incomplete.
+			return;
+		String q = pick(carry);
+		Decode(~q, q.GetLength()); // Strings are null-terminated, so the parameters end safely.
+		if(done || s == e)
+			return;
+	}
+
+	const byte *q = e;
+	while(q > s && IsParam(q[-1]))
+		q--;
+	if(q > s && findarg(q[-1] & 0x7F, 0x21, 0x22, 0x23) >= 0) {
+		carry = String((const char*) q - 1, int(e - q + 1));
+		e = q - 1;
+	}
+
+	if(e > s)
+		Decode(s, int(e - s));
+}
+
+Image SixelStream::Finish()
+{
+	if(deferred) {
+		deferred = false;
+		String q = pick(pending);
+		Create(~q, q.GetLength());
+		return *this;
+	}
+
+	if(!done && !carry.IsEmpty()) {
+		String q = pick(carry);
+		Decode(~q, q.GetLength());
+	}
+	return started ? GetCanvas() : Image();
 }
 }
 
@@ -12,15 +12,27 @@ public:
     
     SixelStream(const void *data, int64 size, Palette *shared_palette = nullptr);
     SixelStream(const String& data, Palette *shared_palette = nullptr);
+    SixelStream(Palette *shared_palette = nullptr);
 
     SixelStream&    Background(bool b = true)       { background = b; return *this;  }
     operator        Image();
 
+    // Incremental decoding.
+    void            Put(const void *data, int size);
+    void            Put(const String& data)         { Put(~data, data.GetLength()); }
+    Image           Finish();
+
+    static Size     GetRasterSize(const String& data);
+
 private:
-    void            Clear();
+    void            Clear(Size canvas = Null);
+    void            Run();
+    bool            RunParallel();
+    void            Decode(const void *data, int size);
+    Image           GetCanvas();
     inline void     Return();
     inline void     LineFeed();
-    void            SetPalette();
+    bool            SetPalette();
     void            GetRasterInfo();
     void            GetRepeatCount();
     int             ReadParams();
@@ -38,8 +50,14 @@ private:
     int             params[8];
     int             coords[6];
     Size            size;
+    Size            raster;
     Point           cursor;
+    String          carry;
+    String          pending;
     bool            background:1;
+    bool            started:1;
+    bool            done:1;
+    bool            deferred:1;
 };
 }
 #endif
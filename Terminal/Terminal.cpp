@@ -54,6 +54,9 @@ TerminalCtrl::TerminalCtrl()
 , notifyprogress(false)
 , ambiguouschartowide(false)
 , semanticinformation(false)
+, scrollblit(true)
+, linecache(false)
+, releasepage(true)
 , page(&dpage)
 , streamfill(false)
 {
@@ -67,6 +70,7 @@ TerminalCtrl::TerminalCtrl()
 	ResetColors();
 	HideScrollBar();
 	TreatAmbiguousCharsAsWideChars(ambiguouschartowide);
+	ScrollBlit(scrollblit);
 	WhenBar = [=](Bar& menu) { StdBar(menu); };
 	sb.WhenScroll = [=]()    { Scroll(); };
 	caret.WhenAction = [=]() { ScheduleRefresh(); };
@@ -81,6 +85,8 @@ TerminalCtrl::~TerminalCtrl()
 	KillTimeCallback(TIMEID_SIZEHINT);
 	KillTimeCallback(TIMEID_BLINK);
 	KillTimeCallback(TIMEID_FLASH);
+	KillTimeCallback(TIMEID_HIBERNATE);
+	ReleaseImageCacheOwner();
 }
 
 TerminalCtrl& TerminalCtrl::SetFont(Font f)
@@ -94,6 +100,48 @@ TerminalCtrl& TerminalCtrl::SetPadding(Size sz)
 {
 	padding = clamp(sz, Size(0, 0), GetFontSize() * 2);
 	Layout();
+	PrescaleImages();
+	return *this;
+}
+
+TerminalCtrl& TerminalCtrl::SetImageDisplay(const Display& d)
+{
+	imgdisplay = &d;
+	prescaleimages = imgdisplay == &ScaledImageCellDisplay(); // Only the scaled display needs the variants.
+	scaledimages.Clear();
+	scaledsize = Null;
+	return *this;
+}
+
+TerminalCtrl& TerminalCtrl::AddHighlightRule(const String& pattern, Color ink, Color paper, bool literal)
+{
+	if(pattern.IsEmpty())
+		return *this;
+	HighlightRule rule;
+	rule.pattern = pattern;
+	rule.ink = ink;
+	rule.paper = paper;
+	if(!literal) {
+		RegExp& re = rule.regex.Create();
+		re.SetPattern(pattern);
+		if(!re.Compile() || re.IsError()) {
+			LLOG("AddHighlightRule(): Invalid pattern: " << pattern);
+			return *this;
+		}
+	}
+	highlightrules.Add(pick(rule));
+	highlightcache.Clear();
+	highlightgen++;
+	Refresh();
+	return *this;
+}
+
+TerminalCtrl& TerminalCtrl::ClearHighlightRules()
+{
+	highlightrules.Clear();
+	highlightcache.Clear();
+	highlightgen++;
+	Refresh();
 	return *this;
 }
 
@@ -204,6 +252,56 @@ void TerminalCtrl::SelectAll(bool history)
 	SetSelection(r.TopLeft(), r.BottomRight(), SEL_TEXT);
 }
 
+bool TerminalCtrl::GotoPrompt(bool next)
+{
+	if(IsAlternatePage())
+		return false;
+	int pos = GetSbPos();
+	Point pt = page->FindSemanticMark(Point(next ? INT_MAX : 0, pos), VTCell::SEMANTIC_PROMPT, next);
+	if(IsNull(pt))
+		return false;
+	Goto(pt.y);
+	return true;
+}
+
+bool TerminalCtrl::GetCommandOutput(int line, Point& pl, Point& ph) const
+{
+	// The output of a command spans from its output mark to the next semantic mark, if any.
+	// If no line is given, the last command is used.
+
+	WakeForAccess();
+	if(line < 0)
+		line = page->GetLineCount() - 1;
+	pl = page->FindSemanticMark(Point(INT_MAX, line), VTCell::SEMANTIC_OUTPUT, false);
+	if(IsNull(pl))
+		return false;
+	ph = page->FindSemanticMark(pl, -1, true);
+	if(IsNull(ph))
+		ph = GetCursorPos();
+	if(ph.x == 0 && ph.y > pl.y) {
+		ph.y--;
+		ph.x = page->FetchLine(ph.y).GetCount();
+	}
+	return ph.y > pl.y || (ph.y == pl.y && ph.x > pl.x);
+}
+
+WString TerminalCtrl::GetCommandOutput(int line) const
+{
+	Point pl, ph;
+	return GetCommandOutput(line, pl, ph) ? AsWString((const VTPage&)*page, Rect(pl, ph)) : WString();
+}
+
+bool TerminalCtrl::SelectCommandOutput(int line)
+{
+	Point pl, ph;
+	if(!GetCommandOutput(line, pl, ph))
+		return false;
+	SetSelection(pl, ph, SEL_TEXT);
+	if(!IsAlternatePage() && (pl.y < GetSbPos() || pl.y >= GetSbPos() + GetPageSize().cy))
+		Goto(pl.y);
+	return true;
+}
+
 String TerminalCtrl::GetSelectionData(const String& fmt) const
 {
 	return IsSelection() ? GetTextClip(GetSelectedText().ToString(), fmt) : Null;
@@ -227,6 +325,9 @@ void TerminalCtrl::SyncSize(bool notify)
 	// avoid this, we check the  new page size, and  do not attempt resize
 	// the page if the requested page size is < 2 x 2 cells.
 
+	if(hibernating) // The page will be resized on wake-up.
+		return;
+
 	Size newsize = GetPageSize();
 	resizing = page->GetSize() != newsize;
 
@@ -279,17 +380,114 @@ void TerminalCtrl::ScheduleRefresh()
 	if(modes[XTSYNCOUT])
 		return;
 
-	if(!delayedrefresh) {
-		SyncSb();
-		RefreshDisplay();
+	if(!delayedrefresh || IsDisplayHidden()) {
+		RefreshFrame();
+		return;
+	}
+
+	if((lazyresize && resizing)
+	|| ExistsTimeCallback(TIMEID_REFRESH))  // Don't cancel a pending refresh.
+		return;
+
+	const RefreshPolicy& p = refreshpolicy;
+	bool bulk = max(framebytes, framestats.lastbytes) >= p.bulksize;
+
+	if(!bulk && framebytes <= p.echosize && msecs(lastframe) >= p.interval) {
+		// Echo-sized write on an idle display: Paint it right away for low latency.
+		framestats.immediate++;
+		RefreshFrame();
+		return;
+	}
+
+	if(bulk)
+		framestats.bulk++;
+
+	SetTimeCallback(bulk ? p.bulkinterval : p.interval, [=] { RefreshFrame(); }, TIMEID_REFRESH);
+}
+
+void TerminalCtrl::RefreshFrame()
+{
+	if(IsDisplayHidden()) {
+		// Nothing to see here. The skipped frame will be refreshed when the ctrl is shown again.
+		// This is called on each write while hidden, so a skipped frame is counted per interval.
+		// The bytes written meanwhile don't count towards the next visible frame.
+		if(!framepending || msecs(lastframe) >= refreshpolicy.interval) {
+			framestats.skipped++;
+			lastframe = msecs();
+		}
+		framepending = true;
+		framebytes = 0;
+		ScheduleHibernation();
+		return;
+	}
+
+	Wake();
+	SyncSb();
+	RefreshDisplay();
+
+	framestats.frames++;
+	framestats.bytes += framebytes;
+	framestats.lastbytes = framebytes;
+	framestats.lastinterval = msecs(lastframe);
+	lastframe = msecs();
+	framebytes = 0;
+	framepending = false;
+}
+
+bool TerminalCtrl::IsDisplayHidden() const
+{
+	// IsShown() also accounts for the hidden parents (e.g. inactive tabs).
+	if(!IsShown())
+		return true;
+	const Ctrl *top = GetTopCtrl();
+	if(!top || !top->IsOpen())
+		return true;
+	const TopWindow *w = GetTopWindow();
+	return w && w->IsMinimized();
+}
+
+void TerminalCtrl::Paint(Draw& w)
+{
+	if(hibernating) {
+		// Draw a blank page, and wake up outside of the paint routine.
+		if(!nobackground)
+			w.DrawRect(GetSize(), colortable[COLOR_PAPER]);
+		if(!ExistsTimeCallback(TIMEID_REFRESH))
+			SetTimeCallback(0, [=] { RefreshFrame(); }, TIMEID_REFRESH);
+		return;
+	}
+
+	dpage.MarkViewed();
+
+	// The lines are painted at their current positions, so a pending scroll delta must
+	// not be blitted later. A partial paint leaves the rest of the view to RefreshDisplay.
+	if(page->GetScrollDelta()) {
+		if(w.GetPaintRect().Contains(Rect(GetSize())))
+			page->ClearScrollDelta();
+		else
+			page->Invalidate();
+	}
+
+	int64 t = usecs();
+	Paint0(w);
+	framestats.painttime = (int) usecs(t);
+
+	// A restored window gets repainted, but the skipped frames still need to be synced.
+	if(framepending && !ExistsTimeCallback(TIMEID_REFRESH))
+		SetTimeCallback(0, [=] { RefreshFrame(); }, TIMEID_REFRESH);
+}
+
+void TerminalCtrl::State(int reason)
+{
+	if(reason != SHOW && reason != OPEN)
+		return;
+	if(IsDisplayHidden())
+		ScheduleHibernation();
+	else {
+		Wake();
+		if(framepending)
+			ScheduleRefresh();
 	}
-	else
-	if((!lazyresize || !resizing)
-	&& !ExistsTimeCallback(TIMEID_REFRESH))  // Don't cancel a pending refresh.
-		SetTimeCallback(16, [=] {
-			SyncSb();
-			RefreshDisplay();
-		}, TIMEID_REFRESH);
 }
 
 void TerminalCtrl::SyncedRefresh(bool enabled)
@@ -323,6 +521,16 @@ void TerminalCtrl::RefreshSizeHint()
 	Refresh(GetViewRect().CenterRect(GetSizeHint().b).Inflated(12));
 }
 
+void TerminalCtrl::SyncPages()
+{
+	// Deferred page maintenance, done after the page operations complete: The shared history
+	// budget is enforced, then the images of the dropped lines are released.
+
+	if(VTHistoryBudget *b = dpage.GetHistoryBudget(); b && b->IsExceeded())
+		b->Trim();
+	ReleaseDroppedImages();
+}
+
 void TerminalCtrl::SyncSb(bool forcescroll)
 {
 	if(IsAlternatePage())
@@ -338,8 +546,12 @@ void TerminalCtrl::SyncSb(bool forcescroll)
 	sb.SetPage(page->GetSize().cy);
 	sb.SetLine(1);
 
-	if(forcescroll)
+	if(forcescroll) {
+		// Output scrolls of a page that was already at the end are blitted by RefreshDisplay.
+		blitting = sb + pcy == tcy && pcy == page->GetSize().cy && page->GetScrollDelta() > 0;
 		sb.End();
+		blitting = false;
+	}
 	else {
 		// This is to keep the display up-to-date (refreshed) on no-autoscrolling mode.
 		Refresh();
@@ -360,10 +572,25 @@ void TerminalCtrl::Scroll()
 		return;
 
 	WhenScroll();
-	Refresh();
+	if(auto r = GetPageRange(); autolinks)
+		DetectLinks(r.a, r.b);
+	if(!blitting)
+		Refresh();
 	PlaceCaret();
 }
 
+bool TerminalCtrl::CanBlitScroll() const
+{
+	// Overlays and transparent backgrounds can't be moved around.
+	return scrollblit
+		&& !nobackground
+		&& !hinting
+		&& !flashing
+		&& !selectormode
+		&& !IsSelection()
+		&& GetSbPos() + GetPageSize().cy >= page->GetLineCount();
+}
+
 void TerminalCtrl::SwapPage()
 {
 	SyncSize(false);
@@ -386,6 +613,21 @@ void TerminalCtrl::RefreshDisplay()
 	const int cnt = min(pos + psz.cy, page->GetLineCount());
 	int blinkingcells = 0;
 
+	if(int delta = page->GetScrollDelta(); delta != 0) {
+		// Pure vertical scroll: Move the already painted lines and repaint only the exposed ones.
+		page->ClearScrollDelta();
+		if(CanBlitScroll()) {
+			int dy = -delta * csz.cy;
+			ScrollView(RectC(0, 0, wsz.cx, psz.cy * csz.cy), 0, dy);
+			if(!IsNull(caretrect))
+				Refresh(caretrect.Offseted(0, dy));
+		}
+		else
+			Refresh();
+	}
+
+	DetectLinks(pos, cnt);
+
 	const bool hypertext = hyperlinks || annotations;
 	const bool plaintext = !hypertext && !blinkingtext;
 
@@ -398,7 +640,9 @@ void TerminalCtrl::RefreshDisplay()
 		int y = i * csz.cy - (csz.cy * pos);
 		bool invalid = line.IsInvalid();
 
-		if(!plaintext) {
+		// Only the lines that contain hypertext or blinking cells need to be scanned.
+		if(!plaintext
+		&& ((hypertext && line.HasHypertext()) || (blinkingtext && line.HasBlinkingCells()))) {
 			for(int j = 0; j < line.GetCount(); j++) {
 				const VTCell& cell = line[j];
 				int x = j * csz.cx;
@@ -965,6 +1209,7 @@ bool TerminalCtrl::IsSelected(Point pt) const
 
 WString TerminalCtrl::GetSelectedText() const
 {
+	WakeForAccess();
 	return AsWString((const VTPage&)*page, GetSelectionRect(), seltype == SEL_RECT);
 }
 
@@ -1084,7 +1329,7 @@ String TerminalCtrl::GetHypertextContent(Point pt, bool modifier)
 	if(modifier) {
 		const VTCell& cell = page->FetchCell(pt);
 		if(cell.IsHypertext()) {
-			String htxt = GetCachedHypertext(cell.data);
+			String htxt = GetHypertext(cell.data);
 			if(!IsNull(htxt))
 				return htxt;
 			LLOG("Unable to retrieve hypertext from the hypertext cache. Htext id: " << cell.data);
@@ -1109,7 +1354,7 @@ void TerminalCtrl::HighlightHypertext(Point pt)
 				activehtext = cell.data;
 				RefreshDisplay();
 			}
-			String htxt = GetCachedHypertext(activehtext);
+			String htxt = GetHypertext(activehtext);
 			Tip(cell.IsAnnotation() ? "\1[g " + htxt + " ]" : htxt); // Use qtf for annotations.
 		}
 		else {
@@ -1157,7 +1402,7 @@ void TerminalCtrl::EditAnnotation()
 	if(!IsMouseOverAnnotation(mousepos))
 		return;
 	dword id = page->FetchCell(mousepos).data;
-	String txt = GetCachedHypertext(id);
+	String txt = GetHypertext(id);
 	if(!IsNull(txt) && WhenAnnotation(GetMouseViewPos(), txt)) {
 		id = RenderHypertext(txt);
 		SelectAnnotatedCells(mousepos, [id](VTCell& cell) {
@@ -1205,6 +1450,7 @@ void TerminalCtrl::HideAnnotation()
 void TerminalCtrl::Search(const WString& s, int begin, int end, bool visibleonly, bool co,
 								Gate<const VectorMap<int, WString>&, const WString&> fn)
 {
+	WakeForAccess();
 	if(searching || s.IsEmpty() || begin >= end)
 		return;
 
@@ -1257,6 +1503,7 @@ void TerminalCtrl::Find(const WString& s, int begin, int end, bool visibleonly,
 void TerminalCtrl::Find(const WString& s, bool visibleonly,
 	Gate<const VectorMap<int, WString>&, const WString&> fn)
 {
+	WakeForAccess();
 	Search(s, 0, page->GetLineCount(), visibleonly, false, fn);
 }
 
@@ -1269,6 +1516,7 @@ void TerminalCtrl::CoFind(const WString& s, int begin, int end, bool visibleonly
 void TerminalCtrl::CoFind(const WString& s, bool visibleonly,
 	Gate<const VectorMap<int, WString>&, const WString&> fn)
 {
+	WakeForAccess();
 	Search(s, 0, page->GetLineCount(), visibleonly, true, fn);
 }
 
@@ -1311,6 +1559,11 @@ void TerminalCtrl::EditBar(Bar& menu)
 		menu.Separator();
 	}
 	menu.Add(b, AK_SELECTALL, CtrlImg::select_all(), [=] { SelectAll(); });
+	if(HasSemanticInformation()) {
+		bool o = !IsSelectorMode() && page->GetSemanticMarkCount();
+		menu.Add(o, AK_SELECTOUTPUT, [=] { SelectCommandOutput(); });
+		menu.Add(o, AK_COPYOUTPUT,   [=] { CopyCommandOutput();   });
+	}
 	menu.Separator();
 	menu.Add(t_("Selector mode"),[=] { IsSelectorMode() ? EndSelectorMode() : BeginSelectorMode(); })
 		.Check(IsSelectorMode())
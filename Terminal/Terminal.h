@@ -3,11 +3,13 @@
 
 #include <CtrlLib/CtrlLib.h>
 #include <plugin/jpg/jpg.h>
+#include <plugin/pcre/Pcre.h>
 
 #include <AnsiParser/AnsiParser.h>
 
 #include "Page.h"
 #include "Sixel.h"
+#include "Base64.h"
 
 namespace Upp {
 
@@ -84,6 +86,7 @@ public:
         TIMEID_SIZEHINT,
         TIMEID_BLINK,
         TIMEID_FLASH,
+        TIMEID_HIBERNATE,
         TIMEID_COUNT
     };
 
@@ -96,6 +99,36 @@ public:
         operator    Value() const                               { return RichValue<TerminalCtrl::InlineImage>(*this); }
     };
 
+    // Adaptive display refresh (frame scheduling) policy.
+    struct RefreshPolicy {
+        int         interval     = 16;      // Frame interval, in ms.
+        int         bulkinterval = 50;      // Frame interval during sustained bulk output, in ms.
+        int         echosize     = 256;     // Writes up to this size are painted immediately if the display is idle.
+        int         bulksize     = 32768;   // Bytes per frame that mark the output as bulk output.
+    };
+
+    // Per-frame statistics.
+    struct FrameStats {
+        int64       frames       = 0;       // Refreshed frames.
+        int64       immediate    = 0;       // Frames refreshed without delay (echo-sized writes).
+        int64       bulk         = 0;       // Frames refreshed at the bulk output rate.
+        int64       skipped      = 0;       // Frames skipped while the ctrl was hidden or minimized.
+        int64       bytes        = 0;       // Total number of bytes written.
+        int64       lastbytes    = 0;       // Bytes written within the last frame.
+        int         lastinterval = 0;       // Time elapsed between the last two frames, in ms.
+        int         painttime    = 0;       // Time spent in the last paint, in us.
+    };
+
+    // Hibernation statistics.
+    struct HibernationStats {
+        int64       hibernations  = 0;      // Times the terminal was packed.
+        int64       wakeups       = 0;      // Times the terminal was expanded.
+        int64       queuedbytes   = 0;      // Total number of bytes queued while hibernating.
+        int64       cellbytes     = 0;      // Memory held by the lines at the last hibernation.
+        int64       snapshotbytes = 0;      // Size of the last session snapshot.
+        int64       packedbytes   = 0;      // Size of the last compressed session snapshot.
+    };
+
     TerminalCtrl();
     virtual ~TerminalCtrl();
 
@@ -154,11 +187,15 @@ public:
 
     TerminalCtrl&   History(bool b = true)                          { dpage.History(b); return *this; }
     TerminalCtrl&   NoHistory()                                     { return History(false); }
-    TerminalCtrl&   ClearHistory()                                  { dpage.EraseHistory(); return *this; }
+    TerminalCtrl&   ClearHistory()                                  { dpage.EraseHistory(); ReleaseDroppedImages(); return *this; }
     bool            HasHistory() const                              { return dpage.HasHistory(); }
 
-    TerminalCtrl&   SetHistorySize(int sz)                          { dpage.SetHistorySize(sz); return *this; }
+    TerminalCtrl&   SetHistorySize(int sz)                          { dpage.SetHistorySize(sz); ReleaseDroppedImages(); return *this; }
     int             GetHistorySize() const                          { return dpage.GetHistorySize(); }
+    int64           GetHistoryUsage() const                         { return dpage.GetHistoryBytes(); }
+
+    TerminalCtrl&   SetHistoryBudget(VTHistoryBudget& b)            { dpage.SetHistoryBudget(&b); return *this; }
+    TerminalCtrl&   NoHistoryBudget()                               { dpage.SetHistoryBudget(nullptr); return *this; }
 
     TerminalCtrl&   SetFont(Font f);
     Font            GetFont() const                                 { return font; }
@@ -270,6 +307,20 @@ public:
     TerminalCtrl&   NoHyperlinks()                                  { return Hyperlinks(false);     }
     bool            HasHyperlinks() const                           { return hyperlinks; }
 
+    // Plain-text link detection. Detected links require hyperlinks to be enabled.
+    enum AutoLinkFlags : dword {
+        AUTOLINK_NONE   = 0,
+        AUTOLINK_URL    = 1,    // scheme://... and mailto: links.
+        AUTOLINK_PATH   = 2,    // File paths, and file:line[:column] references.
+        AUTOLINK_HASH   = 4,    // Hexadecimal hashes (e.g. git commit ids).
+        AUTOLINK_ALL    = AUTOLINK_URL | AUTOLINK_PATH | AUTOLINK_HASH
+    };
+
+    TerminalCtrl&   AutoLinks(dword flags = AUTOLINK_URL | AUTOLINK_PATH);
+    TerminalCtrl&   NoAutoLinks()                                   { return AutoLinks(AUTOLINK_NONE); }
+    dword           GetAutoLinks() const                            { return autolinks; }
+    bool            HasAutoLinks() const                            { return autolinks != AUTOLINK_NONE; }
+
     TerminalCtrl&   Annotations(bool b = true)                      { annotations = b; return *this; }
     TerminalCtrl&   NoAnnotations()                                 { return Annotations(false);     }
     bool            HasAnnotations() const                          { return annotations; }
@@ -286,10 +337,36 @@ public:
     TerminalCtrl&   NoDelayedRefresh()                              { return DelayedRefresh(false); }
     bool            IsDelayingRefresh() const                       { return delayedrefresh; }
 
+    TerminalCtrl&   SetRefreshPolicy(const RefreshPolicy& p)        { refreshpolicy = p; return *this; }
+    const RefreshPolicy& GetRefreshPolicy() const                   { return refreshpolicy; }
+    const FrameStats& GetFrameStats() const                         { return framestats; }
+    void            ResetFrameStats()                               { framestats = FrameStats(); }
+
     TerminalCtrl&   LazyResize(bool b = true)                       { lazyresize = b; return *this; }
     TerminalCtrl&   NoLazyResize()                                  { return LazyResize(false);     }
     bool            IsLazyResizing() const                          { return lazyresize; }
 
+    TerminalCtrl&   LineCache(bool b = true)                        { linecache = b; linerasters.Clear(); Refresh(); return *this; }
+    TerminalCtrl&   NoLineCache()                                   { return LineCache(false); }
+    bool            HasLineCache() const                            { return linecache; }
+
+    TerminalCtrl&   ScrollBlit(bool b = true)                       { scrollblit = b; dpage.TrackScrolls(b); apage.TrackScrolls(b); return *this; }
+    TerminalCtrl&   NoScrollBlit()                                  { return ScrollBlit(false); }
+    bool            IsScrollBlitting() const                        { return scrollblit; }
+
+    // Hidden terminals can be packed after an idle period (in ms). 0 disables hibernation.
+    TerminalCtrl&   Hibernation(int idle = 60000);
+    TerminalCtrl&   NoHibernation()                                 { return Hibernation(0); }
+    int             GetHibernationDelay() const                     { return hibernationdelay; }
+    bool            Hibernate();
+    void            Wake();
+    bool            IsHibernating() const                           { return hibernating; }
+    const HibernationStats& GetHibernationStats() const             { return hibernationstats; }
+
+    TerminalCtrl&   ReleaseAlternatePage(bool b = true)             { releasepage = b; if(b && !IsAlternatePage()) apage.Release(); ReleaseDroppedImages(); return *this; }
+    TerminalCtrl&   KeepAlternatePage()                             { return ReleaseAlternatePage(false); }
+    bool            IsReleasingAlternatePage() const                { return releasepage; }
+
     TerminalCtrl&   WindowOps(bool b = true)                        { windowactions = windowreports = b; return *this; }
     TerminalCtrl&   NoWindowOps()                                   { return WindowOps(false);      }
     bool            HasWindowOps() const                            { return windowactions || windowreports; }
@@ -326,10 +403,14 @@ public:
     TerminalCtrl&   DisableHighlight()                              { return EnableHighlight(false); }
     bool            IsHighlightEnabled() const                      { return highlight; }
 
+    TerminalCtrl&   AddHighlightRule(const String& pattern, Color ink, Color paper = Null, bool literal = false);
+    TerminalCtrl&   ClearHighlightRules();
+    int             GetHighlightRuleCount() const                   { return highlightrules.GetCount(); }
+
     TerminalCtrl&   SetBrightness(int level)                        { if(level != brightness) { brightness = clamp(level, 0, 100); Refresh(); } return *this; }
     int             GetBrightness() const                           { return brightness; }
 
-    TerminalCtrl&   SetImageDisplay(const Display& d)               { imgdisplay = &d; return *this; }
+    TerminalCtrl&   SetImageDisplay(const Display& d);
     const Display&  GetImageDisplay() const                         { return *imgdisplay; }
 
     TerminalCtrl&   TreatAmbiguousCharsAsWideChars(bool b = true)   { dpage.SetAmbiguousCellWidth(b ? 2 : 1); apage.SetAmbiguousCellWidth(b ? 2 : 1); return *this; }
@@ -378,6 +459,15 @@ public:
 
     void            Goto(int pos)                                   { if(!IsAlternatePage()) sb.Set(clamp(pos, 0, page->GetLineCount() - 1)); }
 
+    // Semantic prompt (OSC 133) navigation. Line numbers are 0-based buffer positions.
+    bool            GotoPrompt(bool next = false);
+    bool            GotoPreviousPrompt()                            { return GotoPrompt(false); }
+    bool            GotoNextPrompt()                                { return GotoPrompt(true);  }
+    bool            GetCommandOutput(int line, Point& pl, Point& ph) const;
+    WString         GetCommandOutput(int line = -1) const;
+    bool            SelectCommandOutput(int line = -1);
+    void            CopyCommandOutput(int line = -1)                { Copy(GetCommandOutput(line)); }
+
     void            Find(const WString& s, bool visibleonly,
                                     Gate<const VectorMap<int, WString>&, const WString&> fn);
     void            Find(const WString& s, int begin, int end, bool visibleonly,
@@ -393,7 +483,8 @@ public:
 
     void            Layout() override                               { SyncSize(true); SyncSb(); }
 
-    void            Paint(Draw& w)  override                        { Paint0(w); }
+    void            Paint(Draw& w)  override;
+    void            State(int reason) override;
     void            PaintPage(Draw& w)                              { Paint0(w, true); }
 
     bool            Key(dword key, int count) override;
@@ -468,9 +559,22 @@ public:
     void            Jsonize(JsonIO& jio) override;
     void            Xmlize(XmlIO& xio) override;
 
+    // Session snapshots: The pages, including the history buffer, and the emulator state.
+    bool            SaveSession(Stream& s);
+    bool            LoadSession(Stream& s);
+
     static void     ClearImageCache();
     static void     SetImageCacheMaxSize(int maxsize, int maxcount);
 
+    TerminalCtrl&   SetImageCacheBudget(int64 bytes)                { imagebudget = max<int64>(1, bytes); return *this; }
+    TerminalCtrl&   SetKittyImageBudget(int64 bytes)                { kittystorebudget = max<int64>(0, bytes); return *this; }
+    int64           GetKittyImageBudget() const                     { return kittystorebudget; }
+    int64           GetImageCacheBudget() const                     { return imagebudget; }
+    int64           GetImageCacheUsage() const;
+    TerminalCtrl&   SetImageStoreBudget(int64 bytes)                { imagestorebudget = max<int64>(1, bytes); return *this; }
+    int64           GetImageStoreBudget() const                     { return imagestorebudget; }
+    int64           GetImageStoreUsage() const                      { return imagestorebytes; }
+
     static void     ClearHyperlinkCache();
     static void     SetHyperlinkCacheMaxSize(int maxcount);
 
@@ -478,7 +582,7 @@ protected:
     virtual void    PreParse()                                      { }
     virtual void    PostParse()                                     { ScheduleRefresh(); }
 
-    const VTPage&   GetPage() const                                 { return *page; }
+    const VTPage&   GetPage() const                                 { WakeForAccess(); return *page; }
     const VTCell&   GetAttrs() const                                { return cellattrs;  }
     int             GetSbPos() const                                { return IsAlternatePage() ? 0 : sb; }
     Point           GetCursorPos() const                            { return --page->GetPos(); /* VT cursor position is 1-based */ }
@@ -517,11 +621,14 @@ private:
     void        SwapPage();
 
     void        ScheduleRefresh();
+    void        RefreshFrame();
+    bool        IsDisplayHidden() const;
 
     void        Blink(bool b);
 
     void        Scroll();
     void        SyncSb(bool forcescroll = false);
+    bool        CanBlitScroll() const;
 
     void        SyncSize(bool notify = true);
 
@@ -590,6 +697,7 @@ private:
         Protocol              format   = SIXEL;
         dword                 flags    = KEEPRATIO;
         SixelStream::Palette *palette  = nullptr;
+        dword                 hash     = 0;       // Content hash of data, computed while it is received.
 
         ImageString&          FmtSixel()                  { format = SIXEL; return *this; }
         ImageString&          FmtRaster()                 { format = RASTER; return *this; }
@@ -611,15 +719,51 @@ private:
         bool IsTransparent() const                        { return flags & NOBACKGROUND; }
         bool IsEncoded() const                            { return flags & ENCODED; }
 
-        dword GetHashValue() const                        { return FoldHash(CombineHash(id, data, size, (format << 8) | (flags & 0xFF))); }
+        dword GetHashValue() const                        { return hash ? FoldHash(CombineHash(id, hash, data.GetLength(), size, (format << 8) | (flags & 0xFF)))
+                                                                        : FoldHash(CombineHash(id, data, size, (format << 8) | (flags & 0xFF))); }
 
-        void  Clear()                                     { id = 0; data = Null; size = Null; format = SIXEL; flags = KEEPRATIO; palette = nullptr; }
+        void  Clear()                                     { id = 0; data = Null; size = Null; format = SIXEL; flags = KEEPRATIO; palette = nullptr; hash = 0; }
         bool  IsNullInstance() const                      { return Upp::IsNull(data); }
 
         ImageString()                                     { Clear(); }
         ImageString(const Nuller&)                        { Clear(); }
         ImageString(String&& s)                           { Clear(); data = pick(s); }
     }   chunkedimage;                                     // For generic chunked-images (currently used only by Kitty)
+    xxHashStream chunkedhash;
+
+    struct ChunkedImageDecoder {                          // Decodes the chunks as they arrive.
+        Base64Decoder base64;
+        One<Zlib>   zlib;
+        ImageBuffer pixels;                               // Raw RGB(A) data is written here directly.
+        String      data;                                 // Other formats (e.g. PNG) are collected here.
+        String      partial;                              // Incomplete pixel.
+        int         count;
+        int         bpp;
+        bool        started;
+        bool        failed;
+
+        void        Start(const ImageString& imgs, bool decode);
+        void        Put(const String& enc, bool last);
+        void        Write(const char *s, int n);
+        bool        IsRaw() const                         { return bpp > 0; }
+        bool        IsError() const                       { return failed; }
+        Image       GetImage();
+        void        Clear();
+        ChunkedImageDecoder()                             { Clear(); }
+    }   chunkeddecoder;
+    int         chunkedaction = 'T';
+
+    struct KittyImage : Moveable<KittyImage> {            // Transmitted (a=t) Kitty images, by id.
+        ImageString imgs;
+        Image       image;
+        int64       tick = 0;
+        int64       GetSize() const                       { return imgs.data.GetLength() + (int64) image.GetLength() * 4; }
+    };
+    VectorMap<int64, KittyImage> kittystore;
+    int64       kittystorebytes  = 0;
+    int64       kittystorebudget = 1024 * 1024 * 320;
+    int64       kittystoretick   = 0;
+    VectorMap<dword, int64> kittyplacements;            // Image ids of the placed images -> Kitty image ids.
 
     struct InlineImageMaker : LRUCache<InlineImage>::Maker {
         dword   id;
@@ -627,6 +771,9 @@ private:
         const   ImageString& imgs;
         String  Key() const override;
         int     Make(InlineImage& imagedata) const override;
+        Size    AdjustSize(Size sr, Size sz) const;
+        Size    ToCellSize(Size sz) const;
+        Image   decoded;    // Optional, predecoded image.
         InlineImageMaker(int i, const ImageString& s, const Size& sz)
         : id(i)
         , fontsize(sz)
@@ -635,29 +782,34 @@ private:
         }
     };
 
-    struct HypertextMaker : ValueMaker {
-        dword id;
-        const String& txt;
-        String Key() const override;
-        int    Make(Value& obj) const override;
-        HypertextMaker(int i, const String& s)
-        : id(i)
-        , txt(s)
-        {
-        }
-    };
-
     void        Paint0(Draw& w, bool print = false);
     void        PaintSizeHint(Draw& w);
 
     void        PaintImages(Draw& w, ImageParts& parts, const Size& csz);
+    Image       GetScaledImage(dword id, const InlineImage& im, const Size& csz);
+    void        PrescaleImages();
     void        CollectImage(ImageParts& ip, int x, int y, const VTCell& cell, const Size& sz);
 
-    void        RenderImage(const ImageString& simg, bool scroll = true);
-    const InlineImage& GetCachedImageData(dword id, const ImageString& simg, const Size& csz);
+    dword       RenderImage(const ImageString& simg, bool scroll = true, const Image& decoded = Null);
+    InlineImage GetCachedImageData(dword id, const ImageString& simg, const Size& csz, const Image& decoded = Null);
+    void        StoreImage(dword id, const InlineImage& imd);
+    void        SweepImages(dword keep = 0);
+    void        ReleaseDroppedImages();
+    void        SyncPages();
+    void        SerializeImages(Stream& s);
+    bool        DecodeImageAsync(dword id, const ImageString& simg, const Size& csz, Size& cellsize);
+    void        RefreshImage(dword id);
+    static bool IsImagePending(dword id);
+    int         GetImageCacheOwner();
+    void        ReleaseImageCacheOwner();
 
     dword       RenderHypertext(const String& uri);
-    String      GetCachedHypertext(dword id, const String& data = Null);
+    String      GetHypertext(dword id) const;
+    void        SweepHypertexts();
+
+    void        DetectLinks(int begin, int end);
+    void        ScanLinks(const LogicalLineView& v);
+    void        ResetLinks(VTPage& p);
 
 private:
     enum ModifierKeyFlags : dword {
@@ -675,6 +827,7 @@ private:
     Gate<const VTCell&> cellfilter;
     const Display *imgdisplay;
     SixelStream::Palette         sixelpalette; // Shared palette
+    One<SixelStream>             sixelstream;  // Incremental sixel decoder
     VScrollBar  sb;
     Scroller    scroller;
     Point       mousepos;
@@ -697,15 +850,50 @@ private:
     bool        hinting          = false;
     bool        flashing         = false;
     bool        blinking         = false;
+    bool        blitting         = false;
+    bool        framepending     = false;
+    int64       framebytes       = 0;
+    int         lastframe        = 0;
     int         blinkinterval    = 500;
     int         wheelstep        = GUI_WheelScrollLines();
     int         metakeyflags     = MKEY_ESCAPE;
     int         clipaccess       = CLIP_NONE;
     dword       activehtext      = 0;
+    dword       autolinks        = AUTOLINK_NONE;
+
+    // Interned hyperlinks and annotations. Cells refer to them by their index + 1.
+    Index<String> hypertexts;
+    int         hypertextcount   = 0;       // Linked entries.
+    int         hypertextsweep   = 1024;
     dword       prevhtext        = 0;
     int         overridetracking = K_SHIFT_CTRL;
     Size        padding          = { 0, 0 };
     int         brightness       = 100;
+    RefreshPolicy refreshpolicy;
+    FrameStats  framestats;
+    HibernationStats hibernationstats;
+    String      hibernated;                 // Compressed session snapshot.
+    String      queuedout;                  // Output received while hibernating.
+    bool        queuedutf8       = true;
+    bool        hibernating      = false;
+    int         hibernationdelay = 0;
+    int         imageowner       = 0;
+    int64       imagebudget      = 1024 * 1024 * 128;
+
+    // Per-terminal image store: Holds the materialized images for as long as their cells refer to them.
+    struct StoredImage : Moveable<StoredImage> {
+        InlineImage data;
+        int64       size = 0;
+        int64       tick = 0;
+    };
+    VectorMap<dword, StoredImage> imagestore;
+    int64       imagestorebytes  = 0;
+    int64       imagestorebudget = 1024 * 1024 * 256;
+    int64       imagestoretick   = 0;
+    int         imagestoresweep  = 64;
+    bool        prescaleimages   = false;
+    Size        scaledsize       = Null;
+    VectorMap<dword, Image> scaledimages;
 
     bool        eightbit;
     bool        reversewrap;
@@ -738,6 +926,9 @@ private:
     bool        notifyprogress;
     bool        ambiguouschartowide;
     bool        semanticinformation;
+    bool        scrollblit;
+    bool        linecache;
+    bool        releasepage;
 
 // Down below is the emulator stuff, formerley known as "Console"...
 
@@ -745,8 +936,10 @@ private:
     VTPage*     page;
 
 private:
-    Color       GetColorFromIndex(const VTCell& cell, int which) const;
-    void        SetInkAndPaperColor(const VTCell& cell, Color& ink, Color& paper);
+    Color       GetColorFromIndex(const VTCell& cell, int which, bool dim = false) const;
+    void        SetInkAndPaperColor(const VTCell& cell, Color& ink, Color& paper, bool dim = false);
+    Color       ResolveColor(int index, bool bright, bool faint) const;
+    void        SyncPalette();
     void        ReportANSIColor(int opcode, int index, const Color& c);
     void        ReportDynamicColor(int opcode, const Color& c);
     void        SetProgrammableColors(const AnsiParser::Sequence& seq, int opcode);
@@ -758,6 +951,39 @@ private:
     VectorMap<int, Color> savedcolors;
     Color       colortable[MAX_COLOR_COUNT];
 
+    // Resolved (indexed + default) colors, with bright, faint and dim variants.
+    enum { PALETTE_INK = 256, PALETTE_PAPER, PALETTE_SIZE };
+    static int  GetPaletteIndex(int i, bool bright, bool faint, bool dim) { return ((dim * PALETTE_SIZE + i) << 2) | (bright << 1) | faint; }
+    Vector<Color> palette;
+    Color       palettekey[MAX_COLOR_COUNT];
+    int         palettestate     = -1;
+    int         palettegen       = 0;
+
+    // Rasterized lines, keyed by their content and rendering parameters.
+    VectorMap<String, Image> linerasters;
+
+    // Built-in highlight rules. Their matches are cached per logical line, keyed by the line's content.
+    struct HighlightRule {
+        String      pattern;
+        One<RegExp> regex;      // Empty for literal rules.
+        Color       ink;
+        Color       paper;
+    };
+
+    struct HighlightSpan : Moveable<HighlightSpan> {
+        int         row;        // Relative to the first physical line of the logical line.
+        int         begin;
+        int         end;
+        int         rule;
+    };
+
+    const Vector<HighlightSpan>& GetHighlightSpans(int lo, int hi);
+    Vector<HighlightSpan> EvaluateHighlightRules(const LogicalLineView& v);
+
+    Array<HighlightRule> highlightrules;
+    VectorMap<String, Vector<HighlightSpan>> highlightcache;
+    int         highlightgen     = 0;
+
     struct ColorTableSerializer {
         Color   *table;
         void    Serialize(Stream& s);
@@ -779,6 +1005,7 @@ private:
     void        ParseEscapeSequences(const AnsiParser::Sequence& seq);
     void        ParseCommandSequences(const AnsiParser::Sequence& seq);
     void        ParseDeviceControlStrings(const AnsiParser::Sequence& seq);
+    bool        HookDeviceControlString(const AnsiParser::Sequence& seq);
     void        ParseOperatingSystemCommands(const AnsiParser::Sequence& seq);
     void        ParseApplicationProgrammingCommands(const AnsiParser::Sequence& seq);
 
@@ -818,6 +1045,10 @@ private:
     void        ParseJexerGraphics(const AnsiParser::Sequence& seq);
     bool        ParseiTerm2Graphics(const AnsiParser::Sequence& seq);
     bool        ParseKittyGraphics(const AnsiParser::Sequence& seq);
+    void        StoreKittyImage(const ImageString& imgs, const Image& img);
+    bool        PlaceKittyImage(int64 id);
+    void        AddKittyPlacement(int64 id, dword imageid);
+    void        DeleteKittyImages(int target, int64 id);
 
     bool        ParseItem2FeatureReport(const AnsiParser::Sequence& seq);
     bool        ParseiTerm2BackgroundChange(const AnsiParser::Sequence& seq);
@@ -878,6 +1109,12 @@ private:
 
     void        Reset(bool full);
 
+    void        SerializeSession(Stream& s);
+
+    void        ScheduleHibernation();
+    bool        QueueOutput(const void *data, int size, bool utf8);
+    void        WakeForAccess() const;
+
     void        AlternateScreenBuffer(bool b);
 
     void        VT52MoveCursor();   // VT52 direct cursor addressing.
@@ -316,7 +316,8 @@ in the buffer and the values represent the corresponding line(s)
 as 0`-based indices: If the map contains multiple lines (i.e. 
 count > 1), they should be treated as a [/ wrapped], single and 
 contiguous line. The main purpose of this event is to allow custom 
-cell highlighting by the client code.&]
+cell highlighting by the client code. Only the lines that intersect 
+the area being repainted are passed.&]
 [s3;%- &]
 [s4;%- &]
 [s5;:Upp`:`:TerminalCtrl`:`:WhenWindowMinimize:%- [_^Upp`:`:Event^ Event]<[@(0.0.255) boo
@@ -0,0 +1,57 @@
+#include <Terminal/Terminal.h>
+
+using namespace Upp;
+
+// This example compares the vectorized Base64Decoder of Terminal package with
+// Core's Base64Decode, on plain and line-wrapped (76 columns) base64 data, as
+// a whole and in 4096-byte chunks.
+
+template <class F>
+double Measure(F fn)
+{
+	// Returns the average time of a call, in milliseconds.
+
+	int n = 0, t0 = msecs();
+	do {
+		fn();
+		n++;
+	}
+	while(msecs(t0) < 500);
+	return msecs(t0) / (double) n;
+}
+
+String Wrap(const String& s, int cx)
+{
+	String r;
+	for(int i = 0; i < s.GetLength(); i += cx)
+		r << s.Mid(i, cx) << "\r\n";
+	return r;
+}
+
+GUI_APP_MAIN
+{
+	StdLogSetup(LOG_COUT | LOG_FILE);
+
+	for(int size : { 4 * 1024, 64 * 1024, 1024 * 1024, 16 * 1024 * 1024 }) {
+		String raw;
+		for(int i = 0; i < size; i++)
+			raw.Cat((int) Random(256));
+		String plain = Base64Encode(raw);
+		for(bool wrapped : { false, true }) {
+			String data = wrapped ? Wrap(plain, 76) : plain;
+			String a, b, c;
+			double core    = Measure([&] { a = Base64Decode(data); });
+			double decoder = Measure([&] { b = Base64Decoder::Decode(data); });
+			double chunked = Measure([&] {
+				Base64Decoder base64;
+				for(int i = 0; i < data.GetLength(); i += 4096)
+					base64.Put(~data + i, min(4096, data.GetLength() - i));
+				c = base64.Get();
+			});
+			RLOG(Format("%8d bytes, %s: Base64Decode: %8.3f ms, Base64Decoder: %8.3f ms (%5.2fx), chunked: %8.3f ms (%5.2fx)",
+				size, wrapped ? "wrapped" : "plain  ", core, decoder, core / decoder, chunked, core / chunked));
+			if(a != raw || b != raw || c != raw)
+				RLOG("Decoding mismatch!");
+		}
+	}
+}
@@ -0,0 +1,41 @@
+#include <Terminal/Terminal.h>
+
+using namespace Upp;
+
+// This example measures the time it takes to save and restore the session
+// snapshot of a terminal that holds one million lines of history.
+
+constexpr int LINES = 1000000;
+
+GUI_APP_MAIN
+{
+	StdLogSetup(LOG_COUT | LOG_FILE);
+
+	TerminalCtrl term;
+	term.SetHistorySize(LINES);
+
+	String out;
+	for(int i = 0; i < LINES; i++) {
+		out << "\x1b[3" << i % 8 << "mLine " << i << ": \x1b[1mThe quick brown fox\x1b[m jumps over the lazy dog.\r\n";
+		if(out.GetLength() > 1024 * 1024) {
+			term.WriteUtf8(out);
+			out.Clear();
+		}
+	}
+	term.WriteUtf8(out);
+
+	StringStream ss;
+	int t0 = msecs();
+	if(!term.SaveSession(ss)) {
+		RLOG("Unable to save the session.");
+		return;
+	}
+	String snapshot = ss.GetResult();
+	RLOG("Save:    " << msecs(t0) << " ms, " << snapshot.GetLength() << " bytes");
+
+	TerminalCtrl restored;
+	StringStream rs(snapshot);
+	t0 = msecs();
+	bool ok = restored.LoadSession(rs);
+	RLOG("Restore: " << msecs(t0) << " ms, " << (ok ? "succeeded" : "failed"));
+}
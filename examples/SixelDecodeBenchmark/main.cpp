@@ -0,0 +1,125 @@
+#include <Terminal/Terminal.h>
+
+using namespace Upp;
+
+// This example measures the sixel decoder.
+//
+// 1) A corpus of synthetic images, decoded with and without the raster attributes, as a whole
+//    and chunked (as the terminal does), so the cost of growing the canvas can be compared
+//    with a presized canvas.
+// 2) Real captures (e.g. img2sixel, chafa or libsixel output), read from the directory given
+//    on the command line (*.six, *.sixel). None are shipped with the example.
+// 3) The scaling of the band-parallel decoder with the number of worker threads, on a
+//    3840 x 2160 (4K) image, against the serial decoder.
+
+String MakeSixel(Size sz, int colors, bool raster)
+{
+	String s;
+	if(raster)
+		s << "\"1;1;" << sz.cx << ';' << sz.cy;
+	for(int c = 0; c < colors; c++)
+		s << '#' << c << ";2;" << c * 37 % 101 << ';' << c * 59 % 101 << ';' << c * 83 % 101;
+	for(int y = 0; y < sz.cy; y += 6) {
+		for(int c = 0; c < colors; c++) {
+			s << '#' << c;
+			for(int x = 0; x < sz.cx;) {
+				int n = min(1 + (x * 7 + y + c) % 16, sz.cx - x);
+				int ch = 0x3F + ((x ^ y ^ c) & 0x3F);
+				if(n > 3)
+					s << '!' << n << (char) ch;
+				else
+					s.Cat(ch, n);
+				x += n;
+			}
+			s << '$';
+		}
+		s << '-';
+	}
+	return s;
+}
+
+String GetSixelData(const String& s)
+{
+	// Strips the DCS introducer and the string terminator of a captured sixel sequence.
+
+	int b = 0, e = s.GetLength();
+	if(s.StartsWith("\x1bP")) {
+		b = s.Find('q');
+		b = b < 0 ? 0 : b + 1;
+	}
+	if(s.EndsWith("\x1b\\"))
+		e -= 2;
+	return s.Mid(b, max(0, e - b));
+}
+
+template <class F>
+double Measure(F fn, int duration = 250)
+{
+	// Returns the average time of a call, in milliseconds.
+
+	int n = 0, t0 = msecs();
+	do {
+		fn();
+		n++;
+	}
+	while(msecs(t0) < duration);
+	return msecs(t0) / (double) n;
+}
+
+Image DecodeChunked(const String& data)
+{
+	SixelStream sixel;
+	for(int i = 0; i < data.GetLength(); i += 4096)
+		sixel.Put(~data + i, min(4096, data.GetLength() - i));
+	return sixel.Finish();
+}
+
+void Report(const String& name, const String& data)
+{
+	Image img;
+	double whole   = Measure([&] { img = SixelStream(data); });
+	double chunked = Measure([&] { img = DecodeChunked(data); });
+	RLOG(Format("%-40s %9d bytes: whole: %8.2f ms, chunked: %8.2f ms, result: %d x %d",
+		name, data.GetLength(), whole, chunked, img.GetWidth(), img.GetHeight()));
+}
+
+GUI_APP_MAIN
+{
+	StdLogSetup(LOG_COUT | LOG_FILE);
+
+	RLOG("Synthetic images:");
+	static const Size sizes[] = {
+		{ 64, 64 }, { 320, 240 }, { 640, 480 }, { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 }
+	};
+	for(Size sz : sizes)
+		for(bool raster : { true, false })
+			Report(Format("%d x %d, %s raster attributes", sz.cx, sz.cy, raster ? "with" : "without"),
+				MakeSixel(sz, 16, raster));
+
+	const Vector<String>& cmdline = CommandLine();
+	if(cmdline.GetCount()) {
+		RLOG("Captures:");
+		for(const char *pattern : { "*.six", "*.sixel" })
+			for(FindFile ff(AppendFileName(cmdline[0], pattern)); ff; ff.Next())
+				if(ff.IsFile())
+					Report(ff.GetName(), GetSixelData(LoadFile(ff.GetPath())));
+	}
+
+	// The serial baseline omits the raster attributes, so that the incremental decoder
+	// doesn't hand the image over to the parallel decoder.
+	RLOG("Band-parallel scaling (3840 x 2160, " << CPU_Cores() << " cores):");
+	String data   = MakeSixel(Size(3840, 2160), 16, true);
+	String serial = MakeSixel(Size(3840, 2160), 16, false);
+
+	Image a, b;
+	double base = Measure([&] { a = DecodeChunked(serial); }, 1000);
+	RLOG(Format("Serial:      %8.2f ms", base));
+
+	for(int threads = 1; threads <= CPU_Cores(); threads *= 2) {
+		CoWork::SetPoolSize(threads);
+		double t = Measure([&] { b = SixelStream(data); }, 1000);
+		RLOG(Format("%2d threads: %8.2f ms, speedup: %5.2fx", threads, t, base / t));
+		if(a != b)
+			RLOG("The serial and parallel decoders produced different images!");
+	}
+}
@@ -29,7 +29,7 @@ PtyWaitEvent& GetEventList()
 struct TerminalTab : TerminalCtrl, PtyProcess {
 	TerminalTab()
 	{
-		InlineImages().Hyperlinks().WindowOps();
+		InlineImages().Hyperlinks().WindowOps().Hibernation();
 		WhenBell   = [=]()         { BeepExclamation();    };
 		WhenOutput = [=](String s) { PtyProcess::Write(s); };
 		WhenResize = [=]()         { PtyProcess::SetSize(GetPageSize()); };